@@ -0,0 +1,82 @@
+#ifndef _DELTA_HPP
+#define _DELTA_HPP
+#include "hash.hpp"
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+/* Binary change deltas, as written by ReliableHAMT::drain_changes and read
+ * by ReliableHAMT::apply_delta.
+ *
+ * A delta is a fixed header followed by its records:
+ *
+ *   uint32  magic        "RHD1"
+ *   uint32  count        number of records
+ *   uint64  first        sequence number of the first record
+ *   uint64  length       bytes of records following the header
+ *   uint64  checksum     WyMix::bytes over the records
+ *
+ *   uint8   op           DeltaOp
+ *   hash    hash         the leader's hash of the key, `sizeof(HashType)`
+ *   key                  DeltaCodec<Key>
+ *   value                DeltaCodec<T>, inserts only
+ *
+ * Integers are stored in host (little-endian) order. Any number of deltas
+ * may be concatenated into one stream.
+ */
+enum class DeltaOp : uint8_t { insert = 1, remove = 2 };
+
+struct DeltaHeader {
+    static constexpr uint32_t magic_value = 0x31444852;    // "RHD1"
+    uint32_t magic;
+    uint32_t count;
+    uint64_t first;
+    uint64_t length;
+    uint64_t checksum;
+};
+static_assert(sizeof(DeltaHeader) == 32, "unexpected delta header padding");
+
+
+/* Serialisation of keys and values. Trivially copyable types are stored as
+ * their bytes; specialise this for anything else.
+ */
+template <class T, class Enable = void>
+struct DeltaCodec {
+    static_assert(std::is_trivially_copyable<T>::value,
+            "specialise DeltaCodec for types that are not trivially copyable");
+
+    static void put(std::string& out, const T& v) {
+        out.append(reinterpret_cast<const char *>(&v), sizeof(T));
+    }
+    /* Read one value from [p, end), advancing `p`; false if truncated */
+    static bool get(const char *& p, const char * end, T& v) {
+        if (size_t(end - p) < sizeof(T))
+            return false;
+        std::memcpy(&v, p, sizeof(T));
+        p += sizeof(T);
+        return true;
+    }
+};
+
+/* Strings are stored as a 32-bit length and their characters */
+template <class C, class Traits, class A>
+struct DeltaCodec<std::basic_string<C, Traits, A>> {
+    using S = std::basic_string<C, Traits, A>;
+
+    static void put(std::string& out, const S& s) {
+        DeltaCodec<uint32_t>::put(out, uint32_t(s.size()));
+        out.append(reinterpret_cast<const char *>(s.data()),
+                   s.size() * sizeof(C));
+    }
+    static bool get(const char *& p, const char * end, S& s) {
+        uint32_t n;
+        if (!DeltaCodec<uint32_t>::get(p, end, n) ||
+                size_t(end - p) / sizeof(C) < n)
+            return false;
+        s.assign(reinterpret_cast<const C *>(p), n);
+        p += n * sizeof(C);
+        return true;
+    }
+};
+#endif // _DELTA_HPP
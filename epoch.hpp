@@ -0,0 +1,191 @@
+#ifndef _EPOCH_HPP
+#define _EPOCH_HPP
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/* Epoch-based memory reclamation.
+ *
+ * Threads pin the current global epoch (with a `Guard`) for the duration of
+ * every trie operation. Unlinked nodes are not freed immediately but retired
+ * into a per-thread limbo list tagged with the epoch they were retired in.
+ * The global epoch only advances once every pinned thread has observed it,
+ * so anything retired two or more epochs ago is no longer held by any
+ * operation that was running when it was retired, and is freed in batches.
+ *
+ * This is what lets a trie be read while one thread writes it. The writer
+ * publishes child pointers with release stores, which readers load with
+ * acquire order (protect.hpp), and never changes a leaf entry in place: an
+ * overwrite or a remove unlinks the old entry and retires it here, as
+ * pruning does with emptied nodes. So whatever a pinned reader reaches,
+ * old or new, stays allocated and unchanged until it is unpinned.
+ */
+class EpochReclaimer {
+    struct Record;
+
+public:
+    /* Number of retired objects a thread accumulates before collecting */
+    static constexpr size_t batch = 64;
+
+    /* A single process-wide domain, shared by every trie instance */
+    static EpochReclaimer& instance()
+    {
+        static EpochReclaimer reclaimer;
+        return reclaimer;
+    }
+
+    /* Pins the calling thread to the current epoch. Guards nest. */
+    class Guard {
+    public:
+        Guard() : rec(EpochReclaimer::instance().local()) {
+            if (0 == rec->nest++) {
+                rec->epoch.store(EpochReclaimer::instance()._epoch.load(
+                            std::memory_order_relaxed),
+                        std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+            }
+        }
+        ~Guard() {
+            if (0 == --rec->nest)
+                rec->epoch.store(quiescent, std::memory_order_release);
+        }
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    private:
+        Record * rec;
+    };
+
+    /* Defer `deleter(p)` until no thread can still hold a reference */
+    void retire(void * p, void (*deleter)(void *))
+    {
+        Record * rec = local();
+        const uint64_t now = _epoch.load(std::memory_order_acquire);
+        rec->limbo.push_back({p, deleter, now});
+        if (rec->limbo.size() >= batch)
+            collect();
+    }
+
+    /* Try to advance the epoch and free whatever is now safe; returns the
+     * number of objects freed by this call.
+     */
+    size_t collect()
+    {
+        try_advance();
+        const uint64_t now = _epoch.load(std::memory_order_acquire);
+        size_t freed = free_expired(local()->limbo, now);
+
+        std::lock_guard<std::mutex> guard(_orphan_lock);
+        freed += free_expired(_orphans, now);
+        return freed;
+    }
+
+    /* Number of objects retired by the calling thread (or orphaned by exited
+     * threads) and not yet freed.
+     */
+    size_t pending()
+    {
+        std::lock_guard<std::mutex> guard(_orphan_lock);
+        return local()->limbo.size() + _orphans.size();
+    }
+
+    ~EpochReclaimer()
+    {
+        // Only reached at exit, once no thread is pinned anymore
+        for (auto &r : _orphans)
+            r.deleter(r.p);
+    }
+
+private:
+    static constexpr uint64_t quiescent = UINT64_MAX;
+
+    struct Retired {
+        void * p;
+        void (*deleter)(void *);
+        uint64_t epoch;
+    };
+
+    /* Per-thread state. Records are never freed; a record released by an
+     * exiting thread is reused by the next thread that needs one.
+     */
+    struct alignas(64) Record {
+        std::atomic<uint64_t> epoch{quiescent};
+        std::atomic<bool> in_use{true};
+        unsigned nest = 0;
+        std::vector<Retired> limbo;
+        Record * next = nullptr;
+    };
+
+    /* Releases the thread's record at thread exit, handing its pending
+     * objects over to the orphan list.
+     */
+    struct LocalHandle {
+        Record * rec = nullptr;
+        ~LocalHandle() {
+            if (nullptr == rec)
+                return;
+            EpochReclaimer& r = EpochReclaimer::instance();
+            {
+                std::lock_guard<std::mutex> guard(r._orphan_lock);
+                r._orphans.insert(r._orphans.end(),
+                                  rec->limbo.begin(), rec->limbo.end());
+            }
+            rec->limbo.clear();
+            rec->in_use.store(false, std::memory_order_release);
+        }
+    };
+
+    std::atomic<uint64_t> _epoch{0};
+    std::atomic<Record *> _records{nullptr};
+    std::mutex _orphan_lock;
+    std::vector<Retired> _orphans;
+
+    EpochReclaimer() = default;
+
+    Record * local()
+    {
+        static thread_local LocalHandle handle;
+        if (nullptr != handle.rec)
+            return handle.rec;
+
+        for (Record * r = _records.load(std::memory_order_acquire);
+                r != nullptr; r = r->next) {
+            bool expected = false;
+            if (r->in_use.compare_exchange_strong(expected, true))
+                return handle.rec = r;
+        }
+        Record * r = new Record();
+        r->next = _records.load(std::memory_order_relaxed);
+        while (!_records.compare_exchange_weak(r->next, r)) ;
+        return handle.rec = r;
+    }
+
+    bool try_advance()
+    {
+        uint64_t e = _epoch.load(std::memory_order_acquire);
+        for (Record * r = _records.load(std::memory_order_acquire);
+                r != nullptr; r = r->next) {
+            uint64_t pinned = r->epoch.load(std::memory_order_acquire);
+            if (quiescent != pinned && e != pinned)
+                return false;
+        }
+        return _epoch.compare_exchange_strong(e, e + 1);
+    }
+
+    static size_t free_expired(std::vector<Retired>& list, const uint64_t now)
+    {
+        size_t kept = 0, freed = 0;
+        for (auto &r : list) {
+            if (r.epoch + 2 <= now) {
+                r.deleter(r.p);
+                ++freed;
+            }
+            else {
+                list[kept++] = r;
+            }
+        }
+        list.resize(kept);
+        return freed;
+    }
+};
+#endif // _EPOCH_HPP
@@ -0,0 +1,268 @@
+#ifndef _FROZEN_HPP
+#define _FROZEN_HPP
+#include "rhamt.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/* Immutable, compacted form of a ReliableHAMT for read-mostly use.
+ *
+ * SplitNodes are laid out breadth-first in one buffer. Each node is a 32-bit
+ * bitmap of its occupied children and the 32-bit index of its first child,
+ * the i-th child living at `base + popcount(bitmap below i)`. The record is
+ * stored `2F+1` times and voted on like a child array. Nodes at the last
+ * split level point into the leaf table instead, whose (replicated) start
+ * offsets delimit runs of one packed key/value array.
+ *
+ * Lookups follow the primary copies only. Every index is bounds checked, so
+ * a corrupted record cannot fault, and a key match at the end proves the
+ * path was right; anything else is answered by a second, voted descent.
+ * There are no vtables, per-node allocations or signal handlers.
+ */
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+class FrozenReliableHAMT {
+public:
+    // types
+    typedef ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>
+                                                        mutable_type;
+    typedef Key                                         key_type;
+    typedef T                                           mapped_type;
+    typedef HashType                                    hash_type;
+
+    /* Snapshot the contents of `trie`, see ReliableHAMT::freeze */
+    explicit FrozenReliableHAMT(mutable_type& trie);
+
+    bool   empty() const { return _entries.empty(); }
+    size_t size() const { return _entries.size(); }
+    /* Bytes held by the frozen layout */
+    size_t memory_usage() const;
+
+    const mapped_type * read(const key_type&);
+
+    /* Vote on every node and leaf record, repairing correctable faults;
+     * throws std::runtime_error on an uncorrectable one. Returns the
+     * number of records checked.
+     */
+    size_t scrub();
+
+    /* Back to a mutable trie holding the same entries */
+    mutable_type thaw() const;
+
+protected:
+    static constexpr int nchldrn = mutable_type::nchldrn;
+    static constexpr int nlog2chldrn = mutable_type::nlog2chldrn;
+    static constexpr int maxdepth = mutable_type::maxdepth;
+    static constexpr int ft = 2 * FT + 1;
+
+    struct Link {
+        uint32_t bitmap;
+        uint32_t base;
+        bool operator==(const Link& o) const
+            { return bitmap == o.bitmap && base == o.base; }
+    };
+    using Record = std::array<Link, ft>;
+    using Offset = std::array<uint32_t, ft>;
+    static constexpr Voter<Record, FT> linkvoter = Voter<Record, FT>();
+    static constexpr Voter<Offset, FT> offsetvoter = Voter<Offset, FT>();
+
+    /* Nodes in breadth-first order, the root first */
+    std::vector<Record> _nodes;
+    /* Leaf `i` holds `_entries[_leaves[i] .. _leaves[i+1])` */
+    std::vector<Offset> _leaves;
+    std::vector<std::pair<Key, T>> _entries;
+    /* The trie's key arena, which `_entries` may refer to */
+    std::shared_ptr<KeyArena> _keys;
+    Hash hasher_function;
+    Pred key_eq;
+
+    /* Index of the child for `bit` of the node, or -1 if there is none */
+    static int64_t child(const Link& link, const int bit) {
+        if (!(link.bitmap >> bit & 1))
+            return -1;
+        return int64_t(link.base) +
+               __builtin_popcount(link.bitmap & ((uint32_t(1) << bit) - 1));
+    }
+    /* The voted descent, used whenever the fast one does not find `key` */
+    const mapped_type * safe_read(const hash_type&, const key_type&);
+};
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+FrozenReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+FrozenReliableHAMT(mutable_type& trie)
+    : _keys(trie._keys), hasher_function(trie.hasher_function)
+{
+    EpochReclaimer::Guard guard;
+
+    /* Gather every entry and order them by path: subhash 0 first */
+    std::vector<std::pair<uint64_t, size_t>> order;
+    std::vector<HashType> hashes;
+    auto gather = [&](const HashType hash, const Key& key, const T& val) {
+        uint64_t path = 0;
+        for (int d = 0; d < maxdepth; ++d)
+            path = (path << nlog2chldrn) | mutable_type::subhash(hash, d);
+        order.emplace_back(path, _entries.size());
+        hashes.push_back(hash);
+        _entries.emplace_back(key, val);
+    };
+    trie.for_each_entry(gather);
+    if (_entries.size() > UINT32_MAX)
+        throw std::length_error("too many entries to freeze");
+    std::sort(order.begin(), order.end());
+
+    std::vector<std::pair<Key, T>> entries;
+    std::vector<HashType> sorted;
+    entries.reserve(_entries.size());
+    for (auto &o : order) {
+        entries.push_back(_entries[o.second]);
+        sorted.push_back(hashes[o.second]);
+    }
+    _entries.swap(entries);
+
+    /* Lay the levels out breadth-first. Each node of the current level is
+     * a run of the sorted entries sharing its path prefix.
+     */
+    using Range = std::pair<size_t, size_t>;
+    std::vector<Range> level = { Range(0, _entries.size()) };
+    for (int d = 0; d < maxdepth; ++d) {
+        const bool last = (d == maxdepth - 1);
+        const size_t next_start = _nodes.size() + level.size();
+        std::vector<Range> next;
+        for (auto &r : level) {
+            Link link = { 0, uint32_t(last ? _leaves.size()
+                                           : next_start + next.size()) };
+            for (size_t i = r.first; i < r.second; ) {
+                const int bit = mutable_type::subhash(sorted[i], d);
+                size_t j = i;
+                while (j < r.second &&
+                        (int)mutable_type::subhash(sorted[j], d) == bit)
+                    ++j;
+                link.bitmap |= uint32_t(1) << bit;
+                if (last) {
+                    Offset start;
+                    start.fill(uint32_t(i));
+                    _leaves.push_back(start);
+                }
+                else {
+                    next.emplace_back(i, j);
+                }
+                i = j;
+            }
+            Record rec;
+            rec.fill(link);
+            _nodes.push_back(rec);
+        }
+        level.swap(next);
+    }
+    Offset end;
+    end.fill(uint32_t(_entries.size()));
+    _leaves.push_back(end);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+const T *
+FrozenReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+read(const Key& key)
+{
+    const HashType hash = fold_hash<HashType>(hasher_function(key));
+    int64_t idx = 0;
+    for (int d = 0; d < maxdepth; ++d) {
+        if (idx < 0 || size_t(idx) >= _nodes.size())
+            return safe_read(hash, key);
+        idx = child(_nodes[idx][0], mutable_type::subhash(hash, d));
+    }
+    if (idx < 0 || size_t(idx) + 1 >= _leaves.size())
+        return safe_read(hash, key);
+
+    const size_t lo = _leaves[idx][0], hi = _leaves[idx + 1][0];
+    if (lo <= hi && hi <= _entries.size()) {
+        for (size_t i = lo; i < hi; ++i)
+            if (key_eq(_entries[i].first, key))
+                return &_entries[i].second;
+    }
+    return safe_read(hash, key);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+const T *
+FrozenReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+safe_read(const HashType& hash, const Key& key)
+{
+    int64_t idx = 0;
+    for (int d = 0; d < maxdepth; ++d) {
+        linkvoter(_nodes[idx]);
+        idx = child(_nodes[idx][0], mutable_type::subhash(hash, d));
+        if (idx < 0)
+            return nullptr;
+        if (size_t(idx) >= (d == maxdepth - 1 ? _leaves.size() - 1
+                                              : _nodes.size()))
+            throw std::runtime_error("frozen trie index out of range");
+    }
+    offsetvoter(_leaves[idx]);
+    offsetvoter(_leaves[idx + 1]);
+    const size_t lo = _leaves[idx][0], hi = _leaves[idx + 1][0];
+    if (lo > hi || hi > _entries.size())
+        throw std::runtime_error("frozen trie leaf out of range");
+    for (size_t i = lo; i < hi; ++i)
+        if (key_eq(_entries[i].first, key))
+            return &_entries[i].second;
+    return nullptr;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+size_t
+FrozenReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+scrub()
+{
+    for (auto &rec : _nodes)
+        linkvoter(rec);
+    for (auto &off : _leaves)
+        offsetvoter(off);
+    return _nodes.size() + _leaves.size();
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+size_t
+FrozenReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+memory_usage() const
+{
+    return sizeof(*this) + _nodes.capacity() * sizeof(Record) +
+           _leaves.capacity() * sizeof(Offset) +
+           _entries.capacity() * sizeof(std::pair<Key, T>);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+auto
+FrozenReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+thaw() const -> mutable_type
+{
+    return mutable_type(_entries.begin(), _entries.end());
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+auto
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+freeze() -> FrozenReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>
+{
+    return FrozenReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc,
+                              Protect>(*this);
+}
+#endif // _FROZEN_HPP
@@ -0,0 +1,145 @@
+#ifndef _HASH_HPP
+#define _HASH_HPP
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string_view>
+#include <type_traits>
+
+/* Default hasher for ReliableHAMT.
+ *
+ * The trie consumes the hash five bits at a time from the bottom, and the
+ * sharded front-end selects shards by the top bits, so every bit of the hash
+ * needs to depend on every bit of the key. `std::hash` is the identity for
+ * integers on common standard libraries, which leaves the high levels empty
+ * for sequential or clustered keys. MixHash is a wyhash-style family built on
+ * a 64x64->128 bit multiply: integers and pointers take two multiplies, byte
+ * strings are consumed 16 bytes per multiply, and any other type has its
+ * `std::hash` value mixed.
+ */
+struct WyMix {
+    static constexpr uint64_t p0 = 0xa0761d6478bd642full;
+    static constexpr uint64_t p1 = 0xe7037ed1a0b428dbull;
+    static constexpr uint64_t p2 = 0x8ebc6af09c88c6e3ull;
+    static constexpr uint64_t p3 = 0x589965cc75374cc3ull;
+
+    /* Fold the 128-bit product of `a` and `b` into 64 bits */
+    static uint64_t mum(const uint64_t a, const uint64_t b) {
+        const __uint128_t r = static_cast<__uint128_t>(a) * b;
+        return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+    }
+
+    static uint64_t word(const uint64_t x) {
+        return mum(mum(x ^ p0, p1), x ^ p2);
+    }
+
+    static uint64_t bytes(const void * key, size_t len, uint64_t seed = 0) {
+        const uint8_t * p = static_cast<const uint8_t *>(key);
+        seed ^= mum(seed ^ p0, p1);
+        uint64_t a, b;
+        if (len <= 16) {
+            if (len >= 4) {
+                const size_t off = (len >> 3) << 2;
+                a = (r4(p) << 32) | r4(p + off);
+                b = (r4(p + len - 4) << 32) | r4(p + len - 4 - off);
+            }
+            else if (len > 0) {
+                a = (uint64_t(p[0]) << 16) | (uint64_t(p[len >> 1]) << 8)
+                        | p[len - 1];
+                b = 0;
+            }
+            else {
+                a = b = 0;
+            }
+        }
+        else {
+            size_t i = len;
+            if (i > 48) {
+                uint64_t s1 = seed, s2 = seed;
+                do {
+                    seed = mum(r8(p) ^ p1, r8(p + 8) ^ seed);
+                    s1 = mum(r8(p + 16) ^ p2, r8(p + 24) ^ s1);
+                    s2 = mum(r8(p + 32) ^ p3, r8(p + 40) ^ s2);
+                    p += 48;
+                    i -= 48;
+                } while (i > 48);
+                seed ^= s1 ^ s2;
+            }
+            while (i > 16) {
+                seed = mum(r8(p) ^ p1, r8(p + 8) ^ seed);
+                p += 16;
+                i -= 16;
+            }
+            a = r8(p + i - 16);
+            b = r8(p + i - 8);
+        }
+        return mum(mum(a ^ p1, b ^ seed) ^ p0 ^ len, p1);
+    }
+
+private:
+    static uint64_t r8(const uint8_t * p) {
+        uint64_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+    static uint64_t r4(const uint8_t * p) {
+        uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+};
+
+
+/* Hashers of string keys are transparent (see ReliableHAMT's heterogeneous
+ * lookup): anything convertible to std::string_view hashes as its bytes,
+ * the same as the key itself.
+ */
+template <class Key, bool = std::is_convertible<const Key&,
+                                                std::string_view>::value>
+struct MixHashLookup { };
+
+template <class Key>
+struct MixHashLookup<Key, true> {
+    using is_transparent = void;
+};
+
+
+template <class Key>
+struct MixHash : MixHashLookup<Key> {
+    size_t operator()(const Key& key) const {
+        if constexpr (std::is_integral<Key>::value || std::is_enum<Key>::value)
+            return WyMix::word(static_cast<uint64_t>(key));
+        else if constexpr (std::is_pointer<Key>::value)
+            return WyMix::word(reinterpret_cast<uintptr_t>(key));
+        else if constexpr (std::is_convertible<const Key&,
+                                               std::string_view>::value) {
+            std::string_view s(key);
+            return WyMix::bytes(s.data(), s.size());
+        }
+        else
+            return WyMix::word(std::hash<Key>()(key));
+    }
+
+    template <class K, class = std::enable_if_t<
+            !std::is_same<K, Key>::value &&
+            std::is_convertible<const Key&, std::string_view>::value &&
+            std::is_convertible<const K&, std::string_view>::value>>
+    size_t operator()(const K& key) const {
+        std::string_view s(key);
+        return WyMix::bytes(s.data(), s.size());
+    }
+};
+
+
+/* Reduce a hasher's result to `HashType` by XOR-folding the upper halves
+ * down, so that no bits of the hasher's output are simply discarded. A
+ * result that already fits in `HashType` is returned unchanged.
+ */
+template <class HashType>
+constexpr HashType fold_hash(uint64_t h)
+{
+    for (unsigned shift = 32; shift >= sizeof(HashType) * 8; shift >>= 1)
+        h ^= h >> shift;
+    return static_cast<HashType>(h);
+}
+#endif // _HASH_HPP
@@ -13,8 +13,9 @@ bool unit_test(bool (*f)(void), std::string name)
 
 bool test_swap_local(int depth)
 {
-    // Key, Val, FT, HashType
-    Injector<uint16_t, uint16_t, FT, uint16_t> injector;
+    // Key, Val, FT, HashType, Hash. Faults are placed by hash, so the tests
+    // use the identity hash to make every 16-bit path exist.
+    Injector<uint16_t, uint16_t, FT, uint16_t, std::hash<uint16_t>> injector;
 
     for (int i = 0; i < 65536; ++i)
         injector.insert(i, i);
@@ -38,7 +39,7 @@ bool test_swap_local_deep(void)
 
 bool test_swap_other(int depth1, int depth2)
 {
-    Injector<uint16_t, uint16_t, FT, uint16_t> injector;
+    Injector<uint16_t, uint16_t, FT, uint16_t, std::hash<uint16_t>> injector;
     
     for (int i = 0; i < 65536; ++i)
         injector.insert(i, i);
@@ -61,7 +62,7 @@ bool test_swap_other_diff(void)
 
 bool test_set_child(int depth, std::optional<void*> val, int count)
 {
-    Injector<uint16_t, uint16_t, FT, uint16_t> injector;
+    Injector<uint16_t, uint16_t, FT, uint16_t, std::hash<uint16_t>> injector;
     
     for (int i = 0; i < 65536; ++i)
         injector.insert(i, i);
@@ -82,6 +83,389 @@ bool test_set_child_null(void)
 bool test_set_child_rand(void)
     { return test_set_child(2, std::optional<void*>(), FT-1); }
 
+bool test_set_child_null_primary(void)
+    { return test_set_child(2, std::optional<void*>(nullptr), 1); }
+
+bool test_set_child_rs(void)
+{
+    // Single corrupted word in a Reed-Solomon protected child array
+    Injector<uint16_t, uint16_t, FT, uint16_t, std::hash<uint16_t>,
+             std::equal_to<uint16_t>,
+             std::allocator<std::pair<const uint16_t, uint16_t>>,
+             ReedSolomonSlots> injector;
+
+    for (int i = 0; i < 65536; ++i)
+        injector.insert(i, i);
+
+    injector.set_child(0, 2, 0, std::optional<void*>(), 1);
+
+    for (int i = 0; i < 65536; ++i) {
+        const uint16_t * p = injector.read(i);
+        assert(*p == i);
+    }
+
+    return 1;
+}
+
+bool test_rs_inline_sampled(void)
+{
+    // With sampled verification, writes to inline entries skip the vote.
+    // Corrupt the value bits of entries (the key still matches, so the fast
+    // path takes them) and then remove or overwrite them: the write must not
+    // fold the fault into the check words.
+    Injector<uint16_t, uint16_t, FT, uint16_t, std::hash<uint16_t>,
+             std::equal_to<uint16_t>,
+             std::allocator<std::pair<const uint16_t, uint16_t>>,
+             ReedSolomonSlots> injector;
+    using verify = decltype(injector.rhamt)::verify;
+    injector.rhamt.set_verification(verify::sampled, 1000000);
+
+    for (int i = 0; i < 65536; ++i)
+        injector.insert(i, i);
+
+    // One fault per leaf-level array: keys below 2^15 sit in slot 0 of their
+    // own array. The word is the tag, the key at byte 2, the value at byte 4.
+    for (int k = 0; k < 32768; k += 97) {
+        const uintptr_t word = 1 | uintptr_t(k) << 16 |
+                               uintptr_t(k ^ 0x5A5A) << 32;
+        injector.set_child(k, 3, 0, std::optional<void*>((void*)word), 1);
+        if (k % 2)
+            assert(1 == injector.remove(k));
+        else
+            injector.insert(k, k + 1);
+    }
+
+    injector.rhamt.scrub();
+    for (int i = 0; i < 65536; ++i) {
+        const uint16_t * p = injector.read(i);
+        if (i < 32768 && i % 97 == 0 && i % 2) {
+            assert(nullptr == p);
+        }
+        else {
+            const uint16_t expect = (i < 32768 && i % 97 == 0) ? i + 1 : i;
+            assert(nullptr != p && *p == expect);
+        }
+    }
+
+    return 1;
+}
+
+bool test_set_child_numa(void)
+{
+    // Corrupted copies in row 0, at every level, as a fault in one NUMA
+    // node's memory would leave them. Row 0 is the one followed by readers
+    // on node 0.
+    Injector<uint16_t, uint16_t, FT, uint16_t, std::hash<uint16_t>,
+             std::equal_to<uint16_t>,
+             std::allocator<std::pair<const uint16_t, uint16_t>>,
+             NumaSlots> injector;
+
+    for (int i = 0; i < 65536; ++i)
+        injector.insert(i, i);
+
+    // Deepest first, since placing a fault follows the primary copies
+    for (int depth = 2; depth >= 0; --depth)
+        for (unsigned child = 0; child < 32; child += 3)
+            injector.set_child(rand(), depth, child, std::optional<void*>(),
+                               1);
+
+    for (int i = 0; i < 65536; ++i) {
+        const uint16_t * p = injector.read(i);
+        assert(*p == i);
+    }
+
+    return 1;
+}
+
+bool test_set_hash_sampled(void)
+{
+    // A corrupted primary hash must still be caught when most accesses
+    // skip the vote. The values are too wide to be stored inline, so every
+    // key gets a LeafNode.
+    Injector<uint16_t, uint64_t, FT, uint16_t, std::hash<uint16_t>> injector;
+    using verify = decltype(injector.rhamt)::verify;
+    injector.rhamt.set_verification(verify::sampled, 1000000);
+
+    for (int i = 0; i < 65536; ++i)
+        injector.insert(i, i);
+
+    injector.set_hash(0, std::optional<uint16_t>(0xBEEF), 1);
+    injector.set_hash(1, std::optional<uint16_t>(0xBEEF), 1);
+
+    for (int i = 0; i < 65536; ++i) {
+        const uint64_t * p = injector.read(i);
+        assert(*p == (uint64_t)i);
+    }
+
+    // The reads themselves must have caught and repaired both faults
+    for (uint16_t h = 0; h < 2; ++h)
+        for (unsigned copy = 0; copy < 2 * FT + 1; ++copy)
+            assert(injector.get_hash(h, copy) == h);
+
+    return 1;
+}
+
+bool test_set_child_inline(void)
+{
+    // Corrupt the primary copy of an inline entry's slot, both with another
+    // entry's word and with a random one
+    Injector<uint16_t, uint16_t, FT, uint16_t, std::hash<uint16_t>> injector;
+
+    for (int i = 0; i < 65536; ++i)
+        injector.insert(i, i);
+
+    injector.swap_children_local(0, 3, 0, 1);
+    injector.set_child(1, 3, 0, std::optional<void*>(), 1);
+
+    for (int i = 0; i < 65536; ++i) {
+        const uint16_t * p = injector.read(i);
+        assert(*p == i);
+    }
+
+    return 1;
+}
+
+bool test_frozen_records(void)
+{
+    // Corrupt the primary copy of many node and leaf records of a frozen
+    // trie; reads must still find every value through the voted descent
+    ReliableHAMT<uint16_t, uint16_t, FT, uint16_t, std::hash<uint16_t>> rhamt;
+    for (int i = 0; i < 65536; ++i)
+        rhamt.insert(i, i);
+    FrozenInjector<uint16_t, uint16_t, FT, uint16_t, std::hash<uint16_t>>
+                                                        frozen(rhamt);
+
+    for (int i = 0; i < 200; ++i) {
+        frozen.set_node(rand() % frozen.nodes(), 1);
+        frozen.set_leaf(rand() % frozen.leaves(), std::optional<uint32_t>(), 1);
+    }
+
+    for (int i = 0; i < 65536; ++i) {
+        const uint16_t * p = frozen.read(i);
+        assert(*p == i);
+    }
+    frozen.scrub();
+
+    return 1;
+}
+
+bool test_snapshot_shared(void)
+{
+    // Corrupt the primary copy of slots in nodes shared by the trie and a
+    // snapshot, then rewrite every key: path copies must vote before they
+    // copy, and both versions must still read back correctly
+    Injector<uint16_t, uint64_t, FT, uint16_t, std::hash<uint16_t>> injector;
+
+    for (int i = 0; i < 65536; ++i)
+        injector.insert(i, i);
+    auto snap = injector.rhamt.snapshot();
+
+    injector.swap_children_local(0, 2, 0, 1);
+    injector.set_child(1, 3, 0, std::optional<void*>(), 1);
+    injector.set_hash(2, std::optional<uint16_t>(), 1);
+
+    for (int i = 0; i < 65536; ++i)
+        injector.insert(i, i + 1);
+    for (int i = 0; i < 65536; ++i) {
+        const uint64_t * p = snap.read(i);
+        assert(*p == (uint64_t)i);
+        p = injector.read(i);
+        assert(*p == (uint64_t)i + 1);
+    }
+
+    return 1;
+}
+
+bool test_inspect_faults(void)
+{
+    // inspect() votes on its way down, so corrupted primary copies do not
+    // change what it reports, but a wrong key count is flagged
+    Injector<uint16_t, uint64_t, FT, uint16_t, std::hash<uint16_t>> injector;
+
+    for (int i = 0; i < 65536; ++i)
+        injector.insert(i, i);
+    auto clean = injector.rhamt.inspect();
+    assert(clean.entries == 65536);
+    assert(clean.count_mismatches == 0);
+
+    injector.swap_children_local(0, 1, 0, 1);
+    injector.set_child(1, 2, 3, std::optional<void*>(), 1);
+    auto voted = injector.rhamt.inspect();
+    assert(voted.entries == clean.entries);
+    assert(voted.split_nodes == clean.split_nodes);
+    assert(voted.count_mismatches == 0);
+
+    injector.set_count(5, 2, 12345);
+    assert(injector.rhamt.inspect().count_mismatches == 1);
+
+    return 1;
+}
+
+/* The identity hash for any integer, so that lookups by `int` are allowed */
+struct IdentityHash {
+    using is_transparent = void;
+    template <class K>
+    size_t operator()(const K& key) const { return size_t(key); }
+};
+
+template <class V>
+bool test_heterogeneous(void)
+{
+    // Lookups by another key type walk their own descent, which must fall
+    // back to voting just as the fast traversal does
+    Injector<uint16_t, V, FT, uint16_t, IdentityHash, std::equal_to<>>
+        injector;
+
+    for (int i = 0; i < 65536; ++i)
+        injector.insert(i, i);
+
+    injector.swap_children_local(0, 1, 0, 1);
+    injector.swap_children_local(2, 3, 0, 1);
+    injector.set_child(1, 2, 0, std::optional<void*>(), 1);
+    injector.set_child(3, 3, 0, std::optional<void*>(nullptr), 1);
+
+    for (int i = 0; i < 65536; ++i) {
+        const V * p = injector.rhamt.read(i);
+        assert(nullptr != p && *p == V(i));
+        assert(injector.rhamt.read_hashed(uint16_t(i), i) == p);
+    }
+    assert(1 == injector.rhamt.remove(7));
+    assert(!injector.rhamt.contains(7) && injector.rhamt.contains(8));
+
+    return 1;
+}
+
+bool test_heterogeneous_leaf(void)
+    { return test_heterogeneous<uint64_t>(); }
+
+bool test_heterogeneous_inline(void)
+    { return test_heterogeneous<uint16_t>(); }
+
+bool test_parallel_scan_faults(void)
+{
+    // The scans vote on every child array and leaf they visit, so they see
+    // every entry exactly once despite corrupted primary copies
+    Injector<uint16_t, uint64_t, FT, uint16_t, std::hash<uint16_t>> injector;
+
+    for (int i = 0; i < 65536; ++i)
+        injector.insert(i, i);
+
+    injector.swap_children_local(0, 1, 0, 1);
+    injector.set_child(1, 2, 0, std::optional<void*>(nullptr), 1);
+    injector.set_hash(2, std::optional<uint16_t>(), 1);
+
+    const uint64_t sum = injector.rhamt.parallel_reduce(
+            [](uint16_t, uint64_t v) { return v; }, std::plus<uint64_t>(), 4);
+    assert(sum == 65536ull * 65535 / 2);
+
+    return 1;
+}
+
+bool test_capacity_faults(void)
+{
+    // The CLOCK hand votes on every child array it sweeps, so evictions
+    // remove real entries and keep the counts right despite corrupted
+    // primary copies
+    Injector<uint16_t, uint64_t, FT, uint16_t, std::hash<uint16_t>> injector;
+
+    for (int i = 0; i < 65536; ++i)
+        injector.insert(i, i);
+
+    injector.swap_children_local(0, 1, 0, 1);
+    injector.set_child(1, 2, 0, std::optional<void*>(nullptr), 1);
+    injector.set_hash(2, std::optional<uint16_t>(), 1);
+
+    injector.rhamt.set_capacity(60000);
+    assert(injector.rhamt.size() == 60000);
+    auto stats = injector.rhamt.inspect();
+    assert(stats.entries == 60000 && stats.count_mismatches == 0);
+    size_t found = 0;
+    for (int i = 0; i < 65536; ++i) {
+        const uint64_t * p = injector.read(i);
+        if (nullptr != p) {
+            assert(*p == uint64_t(i));
+            ++found;
+        }
+    }
+    assert(found == 60000);
+
+    return 1;
+}
+
+bool test_order_statistics_faults(void)
+{
+    // The descents vote on their path and check each node's count against
+    // its children's, so corrupted pointers and counts change neither the
+    // order nor the ranks, and the counts are repaired on the way
+    Injector<uint16_t, uint64_t, FT, uint16_t, std::hash<uint16_t>> injector;
+
+    for (int i = 0; i < 65536; ++i)
+        injector.insert(i, i);
+
+    injector.swap_children_local(0, 1, 0, 1);
+    injector.set_child(1, 2, 0, std::optional<void*>(nullptr), 1);
+    injector.set_hash(2, std::optional<uint16_t>(), 1);
+    injector.set_count(3, 0, 70000);
+    injector.set_count(5, 2, 12345);
+    injector.set_count(6, 3, 0);
+
+    // Removes on the fast path through the damage keep the counts right
+    for (int i = 0; i < 65536; i += 64)
+        assert(1 == injector.remove(i));
+    const size_t n = 65536 - 1024;
+
+    for (size_t i = 0; i < n; ++i) {
+        auto e = injector.rhamt.nth_by_hash(i);
+        assert(e && e->first == e->second && e->first % 64 != 0);
+        assert(injector.rhamt.rank(e->first) == i);
+    }
+    assert(!injector.rhamt.nth_by_hash(n));
+    assert(injector.rhamt.size() == n);
+    assert(injector.rhamt.inspect().count_mismatches == 0);
+
+    return 1;
+}
+
+bool test_prune_faults(void)
+{
+    // Removes that empty whole subtrees retire their nodes, and every 64th
+    // retirement runs the reclaimer. Pruning only starts once the fault
+    // guard is dropped, so faults taken on the way down recover as usual
+    // and never cut a collection short: the trie ends up empty with exact
+    // counts, and the reclaimer stays usable from other threads.
+    Injector<uint16_t, uint64_t, FT, uint16_t, std::hash<uint16_t>> injector;
+
+    for (int i = 0; i < 65536; ++i)
+        injector.insert(i, i);
+
+    injector.set_child(0, 1, 0, std::optional<void*>(), 1);
+    injector.set_child(0x421, 2, 3, std::optional<void*>(), 1);
+    injector.set_child(0x842, 3, 1, std::optional<void*>(nullptr), 1);
+    injector.swap_children_local(7, 2, 7, 8);
+
+    for (int i = 0; i < 65536; ++i)
+        assert(1 == injector.remove(i));
+    assert(injector.rhamt.empty());
+    auto stats = injector.rhamt.inspect();
+    assert(stats.entries == 0 && stats.count_mismatches == 0);
+
+    std::thread other([] {
+        EpochReclaimer::Guard guard;
+        EpochReclaimer::instance().collect();
+        (void)EpochReclaimer::instance().pending();
+    });
+    other.join();
+    for (int i = 0; i < 4; ++i)
+        EpochReclaimer::instance().collect();
+
+    for (int i = 0; i < 65536; i += 7)
+        injector.insert(i, i);
+    for (int i = 0; i < 65536; i += 7)
+        assert(*injector.read(i) == uint64_t(i));
+
+    return 1;
+}
+
 int main(void)
 {
     unit_test(test_swap_local_shallow, "test_swap_local_shallow");
@@ -92,6 +476,22 @@ int main(void)
 
     unit_test(test_set_child_null, "test_set_child_null");
     unit_test(test_set_child_rand, "test_set_child_rand");
+    unit_test(test_set_child_null_primary, "test_set_child_null_primary");
+    unit_test(test_set_child_rs, "test_set_child_rs");
+    unit_test(test_rs_inline_sampled, "test_rs_inline_sampled");
+    unit_test(test_set_child_numa, "test_set_child_numa");
+
+    unit_test(test_set_hash_sampled, "test_set_hash_sampled");
+    unit_test(test_set_child_inline, "test_set_child_inline");
+    unit_test(test_frozen_records, "test_frozen_records");
+    unit_test(test_snapshot_shared, "test_snapshot_shared");
+    unit_test(test_inspect_faults, "test_inspect_faults");
+    unit_test(test_heterogeneous_leaf, "test_heterogeneous_leaf");
+    unit_test(test_heterogeneous_inline, "test_heterogeneous_inline");
+    unit_test(test_parallel_scan_faults, "test_parallel_scan_faults");
+    unit_test(test_capacity_faults, "test_capacity_faults");
+    unit_test(test_order_statistics_faults, "test_order_statistics_faults");
+    unit_test(test_prune_faults, "test_prune_faults");
     
     return 0;
 }
@@ -2,13 +2,16 @@
 #define _INJECTOR_HPP
 
 #include "rhamt.hpp"
+#include "frozen.hpp"
+#include "numa.hpp"
 #include <stdexcept>
 #include <cstdlib>
 
 template<class Key, class T, unsigned FT, class HashType,
-         class Hash, class Pred, class Alloc>
+         class Hash, class Pred, class Alloc,
+         template <class, size_t, unsigned> class Protect>
 class Injector {
-    using RHAMT = ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc>;
+    using RHAMT = ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>;
     using Node = typename RHAMT::Node;
     using SN = typename RHAMT::SplitNode;
     using LN = typename RHAMT::LeafNode;
@@ -47,6 +50,12 @@ public:
     void set_hash(const HashType hash,
                   std::optional<HashType> val, unsigned count);
 
+    // Copy `copy` of the stored hash in the leaf node along `hash`
+    HashType get_hash(const HashType hash, unsigned copy);
+
+    // Overwrite the key count of the SplitNode at `depth` along `hash`
+    void set_count(const HashType hash, const int depth, size_t val);
+
     const T * insert(const Key& key, const T& val) {
         return rhamt.insert(key, val);
     }
@@ -61,9 +70,10 @@ public:
 
 
 
-template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred, class Alloc>
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
 void
-Injector<Key, T, FT, HashType, Hash, Pred, Alloc>::
+Injector<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
 swap_children_local(const HashType hash, const int depth,
                               const unsigned first, const unsigned second)
 {
@@ -75,16 +85,18 @@ swap_children_local(const HashType hash, const int depth,
     SN* curr_node = &rhamt._root;
     for (int level = 0; level < depth; ++level) {
         HashType shash = RHAMT::subhash(hash, level);
-        curr_node = reinterpret_cast<SN*>(curr_node->children[shash][0]);
+        curr_node = reinterpret_cast<SN*>(curr_node->children.get(shash));
     }
 
-    std::swap(curr_node->children[first][0], curr_node->children[second][0]);
+    std::swap(curr_node->children.raw(first, 0),
+              curr_node->children.raw(second, 0));
 }
 
 
-template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred, class Alloc>
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
 void
-Injector<Key, T, FT, HashType, Hash, Pred, Alloc>::
+Injector<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
 swap_children_other(const HashType hash1, const int depth1,
                               const HashType hash2, const int depth2,
                               const unsigned child)
@@ -97,22 +109,24 @@ swap_children_other(const HashType hash1, const int depth1,
     SN* curr_node_a = &rhamt._root;
     for (int level = 0; level < depth1; ++level) {
         HashType shash = RHAMT::subhash(hash1, level);
-        curr_node_a = reinterpret_cast<SN*>(curr_node_a->children[shash][0]);
+        curr_node_a = reinterpret_cast<SN*>(curr_node_a->children.get(shash));
     }
 
     SN* curr_node_b = &rhamt._root;
     for (int level = 0; level < depth2; ++level) {
         HashType shash = RHAMT::subhash(hash2, level);
-        curr_node_b = reinterpret_cast<SN*>(curr_node_b->children[shash][0]);
+        curr_node_b = reinterpret_cast<SN*>(curr_node_b->children.get(shash));
     } 
 
-    std::swap(curr_node_a->children[child][0], curr_node_b->children[child][0]);
+    std::swap(curr_node_a->children.raw(child, 0),
+              curr_node_b->children.raw(child, 0));
 }
 
 
-template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred, class Alloc>
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
 void
-Injector<Key, T, FT, HashType, Hash, Pred, Alloc>::
+Injector<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
 set_child(const HashType hash, const int depth, unsigned child,
                     std::optional<void*> val, unsigned count)
 {
@@ -124,32 +138,113 @@ set_child(const HashType hash, const int depth, unsigned child,
     SN* curr_node = &rhamt._root;
     for (int level = 0; level < depth; ++level) {
         HashType shash = RHAMT::subhash(hash, level);
-        curr_node = reinterpret_cast<SN*>(curr_node->children[shash][0]);
+        curr_node = reinterpret_cast<SN*>(curr_node->children.get(shash));
     }
 
     Node* rand_ptr = reinterpret_cast<Node*>(rand());
-    for (unsigned i = 0; i < count; ++i)
-        curr_node->children[child][i] = (Node*)val.value_or(rand_ptr);
+    for (unsigned i = 0; i < count && i < decltype(SN::children)::copies; ++i)
+        curr_node->children.raw(child, i) = (Node*)val.value_or(rand_ptr);
 }
 
 
-template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred, class Alloc>
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
 void
-Injector<Key, T, FT, HashType, Hash, Pred, Alloc>::
+Injector<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
 set_hash(const HashType hash, std::optional<HashType> val,
                    unsigned count)
 {
-    int level = 0;
-    SN* curr_node = &rhamt._root;
+    if (count > RHAMT::ft)
+        throw std::out_of_range("Count must be <= 2F+1");
+
+    Node* curr_node = &rhamt._root;
     for (int level = 0; level < RHAMT::maxdepth; ++level) {
         HashType shash = RHAMT::subhash(hash, level);
-        curr_node = reinterpret_cast<SN*>(curr_node->children[shash][0]);
+        curr_node = reinterpret_cast<SN*>(curr_node)->children.get(shash);
     }
 
+    if (RHAMT::InlineEntry::is(curr_node))
+        throw std::invalid_argument("Entry is inline and has no leaf hash");
+
     HashType rand_hash = (HashType)rand();
-    for (int i = 0; i < count; ++i)
-       reinterpret_cast<LN*>(curr_node)->hash[i] = val.value_or(rand_hash);
+    for (unsigned i = 0; i < count; ++i)
+       static_cast<LN*>(curr_node)->hashes[i] = val.value_or(rand_hash);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+HashType
+Injector<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+get_hash(const HashType hash, unsigned copy)
+{
+    if (copy >= RHAMT::ft)
+        throw std::out_of_range("Copy must be < 2F+1");
+
+    Node* curr_node = &rhamt._root;
+    for (int level = 0; level < RHAMT::maxdepth; ++level) {
+        HashType shash = RHAMT::subhash(hash, level);
+        curr_node = reinterpret_cast<SN*>(curr_node)->children.get(shash);
+    }
+
+    if (RHAMT::InlineEntry::is(curr_node))
+        throw std::invalid_argument("Entry is inline and has no leaf hash");
+    return static_cast<LN*>(curr_node)->hashes[copy];
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+void
+Injector<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+set_count(const HashType hash, const int depth, size_t val)
+{
+    if (depth >= RHAMT::maxdepth)
+        throw std::out_of_range("Depth must be < maxdepth");
+
+    SN* curr_node = &rhamt._root;
+    for (int level = 0; level < depth; ++level) {
+        HashType shash = RHAMT::subhash(hash, level);
+        curr_node = reinterpret_cast<SN*>(curr_node->children.get(shash));
+    }
+    curr_node->_count = val;
 }
 
 
+// Fault injection into the records of a frozen trie
+template <class Key, class T, unsigned FT, class HashType = uint32_t,
+          class Hash = MixHash<Key>>
+class FrozenInjector : public FrozenReliableHAMT<Key, T, FT, HashType, Hash> {
+    using Frozen = FrozenReliableHAMT<Key, T, FT, HashType, Hash>;
+
+public:
+    explicit FrozenInjector(typename Frozen::mutable_type& trie)
+        : Frozen(trie) { }
+
+    size_t nodes() const { return this->_nodes.size(); }
+    size_t leaves() const { return this->_leaves.size(); }
+
+    // Overwrite the bitmap and child index of node `idx` with random values
+    // in the first `count` duplicates
+    void set_node(const size_t idx, unsigned count) {
+        if (count > Frozen::ft)
+            throw std::out_of_range("Count must be <= 2F+1");
+        typename Frozen::Link link = { (uint32_t)rand(), (uint32_t)rand() };
+        for (unsigned i = 0; i < count; ++i)
+            this->_nodes.at(idx)[i] = link;
+    }
+
+    // Overwrite the start offset of leaf `idx` in the first `count`
+    // duplicates. If `val` is not set, use a random value.
+    void set_leaf(const size_t idx, std::optional<uint32_t> val,
+                  unsigned count) {
+        if (count > Frozen::ft)
+            throw std::out_of_range("Count must be <= 2F+1");
+        uint32_t rand_off = (uint32_t)rand();
+        for (unsigned i = 0; i < count; ++i)
+            this->_leaves.at(idx)[i] = val.value_or(rand_off);
+    }
+};
+
+
 #endif // _INJECTOR_HPP
@@ -0,0 +1,359 @@
+#ifndef _JOURNAL_HPP
+#define _JOURNAL_HPP
+#include "rhamt.hpp"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Front-end that makes a ReliableHAMT durable with a write-ahead journal.
+ *
+ * The journal file is a sequence of checksummed change deltas (delta.hpp).
+ * A writer applies its change to the trie, whose change log records it, and
+ * then waits until the change is on disk. A flusher thread drains the change
+ * log into one delta every `flush_interval`, or as soon as `max_batch`
+ * changes are waiting, and makes it durable with one write and one
+ * fdatasync, so that concurrent writers share the cost of a sync (group
+ * commit). With a zero interval every mutation is written and synced on its
+ * own, under the lock, before it returns.
+ *
+ * Opening a journal replays it into the trie with `apply_delta`, which
+ * bulk-inserts the surviving entries. The log is cut at the first delta that
+ * is torn or fails its checksum, as left by a crash during a write; every
+ * change acknowledged to a writer precedes it.
+ *
+ * A failed write (or sync) breaks the journal for good: nothing more is
+ * written after a possibly torn delta, and every later mutation throws
+ * without touching the trie. The changes of the failed batch stay in the
+ * trie, but each of their writers has been told that its change failed.
+ */
+template <class Key, class T, unsigned FT = 0, class HashType = uint32_t,
+          class Hash = MixHash<Key>, class Pred = std::equal_to<Key>,
+          class Alloc = std::allocator<std::pair<const Key, T>>,
+          template <class, size_t, unsigned> class Protect = ReplicatedSlots>
+class JournaledReliableHAMT {
+public:
+    // types
+    typedef ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>
+                                                        trie_type;
+    typedef Key                                         key_type;
+    typedef T                                           mapped_type;
+
+    /* Open (or create) the journal at `path` and replay it, bulk-inserting
+     * on `threads` threads. Throws std::system_error if the file cannot be
+     * opened, read or truncated.
+     */
+    explicit JournaledReliableHAMT(const std::string& path,
+            size_t max_batch = 4096,
+            std::chrono::microseconds flush_interval =
+                    std::chrono::microseconds(1000),
+            unsigned threads = 1);
+    /* Flushes whatever is still waiting */
+    ~JournaledReliableHAMT();
+
+    bool   empty() const;
+    size_t size() const;
+
+    /* Mutations return once they are durable, and throw std::system_error
+     * if the journal could not be written, or failed earlier, in which case
+     * the change is not applied either (see above). Safe to call from any
+     * thread.
+     */
+    void insert(const key_type&, const mapped_type&);
+    int remove(const key_type&);
+    /* Reads see a change as soon as it is applied, which may be before it
+     * is durable. The value is copied out under the lock, since any other
+     * thread may overwrite or remove it as soon as the lock is released.
+     */
+    std::optional<mapped_type> read(const key_type&);
+
+    /* Number of fdatasync calls made on the journal so far */
+    size_t syncs() const { return _syncs; }
+
+protected:
+    trie_type _trie;
+    mutable std::mutex _lock;
+    std::condition_variable _flush_cv;      // wakes the flusher
+    std::condition_variable _done_cv;       // wakes writers waiting on it
+    int _fd = -1;
+    size_t _max_batch;
+    std::chrono::microseconds _interval;
+    /* Changes below `_drained` have left the change log, those below
+     * `_durable` are on disk */
+    uint64_t _drained = 0;
+    uint64_t _durable = 0;
+    int _error = 0;
+    bool _stop = false;
+    std::atomic<size_t> _syncs{0};
+    std::thread _flusher;
+
+    void replay(unsigned threads);
+    void flush_loop();
+    /* Wait (under `guard`) for the last change to become durable */
+    void commit(std::unique_lock<std::mutex>& guard);
+    /* Write all of `buf` and sync it; returns 0 or an errno value */
+    int write_out(const std::string& buf);
+    /* Throw if a write has failed (under the lock) */
+    void check_error() const;
+};
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+JournaledReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+JournaledReliableHAMT(const std::string& path, size_t max_batch,
+                      std::chrono::microseconds flush_interval,
+                      unsigned threads)
+    : _max_batch(max_batch ? max_batch : 1), _interval(flush_interval)
+{
+    _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (_fd < 0)
+        throw std::system_error(errno, std::generic_category(), path);
+    try {
+        replay(threads);
+    }
+    catch (...) {
+        ::close(_fd);
+        throw;
+    }
+    if (_interval.count() > 0)
+        _flusher = std::thread(&JournaledReliableHAMT::flush_loop, this);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+JournaledReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+~JournaledReliableHAMT()
+{
+    if (_flusher.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            _stop = true;
+        }
+        _flush_cv.notify_one();
+        _flusher.join();
+    }
+    ::close(_fd);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+void
+JournaledReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+replay(unsigned threads)
+{
+    std::string log;
+    char buf[1 << 16];
+    for (off_t off = 0; ; ) {
+        ssize_t n = ::pread(_fd, buf, sizeof(buf), off);
+        if (n < 0 && EINTR == errno)
+            continue;
+        if (n < 0)
+            throw std::system_error(errno, std::generic_category(),
+                                    "journal read");
+        if (0 == n)
+            break;
+        log.append(buf, n);
+        off += n;
+    }
+
+    /* Keep the longest prefix of intact deltas */
+    size_t valid = 0;
+    uint64_t next = 0;
+    while (log.size() - valid >= sizeof(DeltaHeader)) {
+        DeltaHeader h;
+        std::memcpy(&h, log.data() + valid, sizeof(h));
+        const char * body = log.data() + valid + sizeof(h);
+        if (DeltaHeader::magic_value != h.magic ||
+                log.size() - valid - sizeof(h) < h.length ||
+                WyMix::bytes(body, h.length) != h.checksum)
+            break;
+        valid += sizeof(h) + h.length;
+        next = h.first + h.count;
+    }
+    log.resize(valid);
+    if (!log.empty())
+        _trie.apply_delta(log, 0, threads);
+    if (0 != ::ftruncate(_fd, valid))
+        throw std::system_error(errno, std::generic_category(),
+                                "journal truncate");
+
+    _trie.set_change_log(_max_batch, next);
+    _drained = _durable = next;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+int
+JournaledReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+write_out(const std::string& buf)
+{
+    for (size_t off = 0; off < buf.size(); ) {
+        ssize_t n = ::write(_fd, buf.data() + off, buf.size() - off);
+        if (n < 0 && EINTR == errno)
+            continue;
+        if (n < 0)
+            return errno;
+        off += n;
+    }
+    ++_syncs;
+    return (0 == ::fdatasync(_fd)) ? 0 : errno;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+void
+JournaledReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+flush_loop()
+{
+    /* The sync itself runs without the lock, so writers keep adding to the
+     * next batch while this one is on its way to disk.
+     */
+    std::unique_lock<std::mutex> guard(_lock);
+    while (true) {
+        _flush_cv.wait_for(guard, _interval, [this]() {
+            return _stop || _trie.change_seq() - _drained >= _max_batch;
+        });
+        const uint64_t seq = _trie.change_seq();
+        if (seq == _drained) {
+            if (_stop)
+                return;
+            continue;
+        }
+
+        std::string buf;
+        _trie.drain_changes(buf);
+        _drained = seq;
+        _done_cv.notify_all();      // the change log has room again
+        guard.unlock();
+        const int err = write_out(buf);
+        guard.lock();
+        if (err)
+            _error = err;
+        else
+            _durable = seq;
+        _done_cv.notify_all();
+        if (err)
+            return;     // nothing more may follow a possibly torn delta
+    }
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+void
+JournaledReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+commit(std::unique_lock<std::mutex>& guard)
+{
+    const uint64_t seq = _trie.change_seq();
+    if (0 == _interval.count()) {
+        std::string buf;
+        _trie.drain_changes(buf);
+        _drained = seq;
+        if (const int err = write_out(buf))
+            _error = err;
+        else
+            _durable = seq;
+    }
+    else {
+        if (seq - _drained >= _max_batch)
+            _flush_cv.notify_one();
+        _done_cv.wait(guard, [&]() { return _durable >= seq || _error; });
+    }
+    check_error();
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+void
+JournaledReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+check_error() const
+{
+    if (_error)
+        throw std::system_error(_error, std::generic_category(),
+                                "journal write");
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+void
+JournaledReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+insert(const Key& key, const T& val)
+{
+    std::unique_lock<std::mutex> guard(_lock);
+    // A full change log would drop changes, so wait for the flusher
+    _done_cv.wait(guard, [this]() {
+        return _trie.change_seq() - _drained < _max_batch || _error;
+    });
+    check_error();
+    _trie.insert(key, val);
+    commit(guard);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+int
+JournaledReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+remove(const Key& key)
+{
+    std::unique_lock<std::mutex> guard(_lock);
+    _done_cv.wait(guard, [this]() {
+        return _trie.change_seq() - _drained < _max_batch || _error;
+    });
+    check_error();
+    const int rv = _trie.remove(key);
+    if (rv)
+        commit(guard);
+    return rv;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+std::optional<T>
+JournaledReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+read(const Key& key)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    const T * val = _trie.read(key);
+    if (nullptr == val)
+        return std::nullopt;
+    return *val;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+bool
+JournaledReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+empty() const
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _trie.empty();
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+size_t
+JournaledReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+size() const
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _trie.size();
+}
+#endif // _JOURNAL_HPP
@@ -0,0 +1,204 @@
+#ifndef _KEYS_HPP
+#define _KEYS_HPP
+#include "hash.hpp"
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/* Storage for the bytes of variable-length keys, see ArenaString.
+ *
+ * Keys are copied into 64KB chunks by bumping a pointer (longer keys get a
+ * chunk of their own) and stay there until every arena holding the chunk is
+ * destroyed; removing a key from the trie does not give its bytes back.
+ * Chunks are reference counted so that another arena can adopt them, which
+ * lets a trie take over subtrees whose keys live in another trie's arena.
+ * `store` and `adopt` are safe to call from any thread.
+ */
+class KeyArena {
+public:
+    /* A copy of the `n` bytes at `p`, valid for the life of the arena */
+    const char * store(const char * p, const size_t n) {
+        std::lock_guard<std::mutex> guard(_lock);
+        char * q;
+        if (n > chunk_bytes / 4) {
+            q = add_chunk(n);
+            std::memcpy(q, p, n);
+            return q;
+        }
+        if (n > _left) {
+            _next = add_chunk(chunk_bytes);
+            _left = chunk_bytes;
+        }
+        q = _next;
+        std::memcpy(q, p, n);
+        _next += n;
+        _left -= n;
+        return q;
+    }
+
+    /* Keep every key stored in `other` so far alive as long as this arena */
+    void adopt(KeyArena& other) {
+        if (this == &other)
+            return;
+        std::scoped_lock guard(_lock, other._lock);
+        _chunks.insert(_chunks.end(), other._chunks.begin(),
+                       other._chunks.end());
+        _bytes += other._bytes;
+    }
+
+    /* Bytes of memory held, adopted chunks included */
+    size_t bytes() const {
+        std::lock_guard<std::mutex> guard(_lock);
+        return _bytes;
+    }
+
+private:
+    static constexpr size_t chunk_bytes = size_t(64) << 10;
+
+    mutable std::mutex _lock;
+    std::vector<std::shared_ptr<char[]>> _chunks;
+    char * _next = nullptr;
+    size_t _left = 0;
+    size_t _bytes = 0;
+
+    char * add_chunk(const size_t n) {
+        _chunks.emplace_back(new char[n]);
+        _bytes += n;
+        return _chunks.back().get();
+    }
+};
+
+
+/* A string key for tries that hold many variable-length keys.
+ *
+ * With std::string keys every leaf entry owns a separate heap block for any
+ * key too long for the small-string buffer, and every comparison along a
+ * collision chain touches it. An ArenaString is 24 bytes: the key's full
+ * 64-bit MixHash, its length, and either the key itself (up to 12 bytes) or
+ * a pointer to it. The hash is computed once, when the ArenaString is made,
+ * so the trie never rehashes the key, and it doubles as a fingerprint:
+ * equality compares hash and length before it looks at a single byte.
+ *
+ * An ArenaString made from a string only refers to it, which is all a
+ * lookup needs; the string must outlive the call. When a ReliableHAMT
+ * stores the key, it copies long keys into its own KeyArena, shared by its
+ * copies and snapshots, so keys handed back by the trie stay valid as long
+ * as the trie (or a copy or snapshot of it) does.
+ */
+class ArenaString {
+public:
+    /* Keys of at most this many bytes are held inline */
+    static constexpr size_t inline_max = 12;
+    /* Types other than ArenaString that convert to std::string_view */
+    template <class S>
+    using if_string = std::enable_if_t<!std::is_same<S, ArenaString>::value &&
+            std::is_convertible<const S&, std::string_view>::value>;
+
+    ArenaString() : ArenaString(std::string_view()) { }
+    ArenaString(const std::string_view s)
+        : _hash(WyMix::bytes(s.data(), s.size())), _len(uint32_t(s.size()))
+    {
+        if (s.size() > UINT32_MAX)
+            throw std::length_error("ArenaString key too long");
+        std::memset(_bytes, 0, sizeof(_bytes));
+        if (is_inline())
+            std::memcpy(_bytes, s.data(), s.size());
+        else
+            set_ptr(s.data());
+    }
+    ArenaString(const char * s) : ArenaString(std::string_view(s)) { }
+    ArenaString(const std::string& s) : ArenaString(std::string_view(s)) { }
+
+    const char * data() const { return is_inline() ? _bytes : ptr(); }
+    size_t size() const { return _len; }
+    bool empty() const { return 0 == _len; }
+    /* The key's MixHash, as computed when it was made */
+    uint64_t hash() const { return _hash; }
+    bool is_inline() const { return _len <= inline_max; }
+
+    operator std::string_view() const { return std::string_view(data(), _len); }
+    std::string str() const { return std::string(data(), _len); }
+
+    /* The same key with its bytes copied to `arena` if they are not inline */
+    ArenaString interned(KeyArena& arena) const {
+        if (is_inline())
+            return *this;
+        ArenaString copy(*this);
+        copy.set_ptr(arena.store(ptr(), _len));
+        return copy;
+    }
+
+    friend bool operator==(const ArenaString& a, const ArenaString& b) {
+        return a._hash == b._hash && a._len == b._len &&
+               0 == std::memcmp(a.data(), b.data(), a._len);
+    }
+    friend bool operator!=(const ArenaString& a, const ArenaString& b) {
+        return !(a == b);
+    }
+    /* Against a plain string there is no hash to check first */
+    template <class S, class = if_string<S>>
+    friend bool operator==(const ArenaString& a, const S& b) {
+        const std::string_view s(b);
+        return a._len == s.size() &&
+               0 == std::memcmp(a.data(), s.data(), a._len);
+    }
+    template <class S, class = if_string<S>>
+    friend bool operator==(const S& a, const ArenaString& b) { return b == a; }
+
+private:
+    uint64_t _hash;
+    uint32_t _len;
+    /* The key, or 4 unused bytes and then a pointer to it */
+    char _bytes[inline_max];
+
+    const char * ptr() const {
+        const char * p;
+        std::memcpy(&p, _bytes + 4, sizeof(p));
+        return p;
+    }
+    void set_ptr(const char * p) { std::memcpy(_bytes + 4, &p, sizeof(p)); }
+};
+static_assert(sizeof(ArenaString) == 24, "unexpected ArenaString padding");
+
+/* The hash was taken when the key was made, and agrees with MixHash over
+ * the same bytes as a std::string or std::string_view */
+template <>
+struct MixHash<ArenaString> {
+    using is_transparent = void;
+    size_t operator()(const ArenaString& key) const { return key.hash(); }
+    template <class S, class = ArenaString::if_string<S>>
+    size_t operator()(const S& key) const {
+        const std::string_view s(key);
+        return WyMix::bytes(s.data(), s.size());
+    }
+};
+
+
+/* How a ReliableHAMT stores its keys. By default a key is copied as it is,
+ * and the change log keeps its own copy. Keys that only refer to their
+ * bytes are interned into the trie's KeyArena when they are inserted, and
+ * logged as an owning type with the same DeltaCodec encoding.
+ */
+template <class Key>
+struct KeyStore {
+    static constexpr bool arena = false;
+    typedef Key owned_type;
+    static const Key& intern(KeyArena *, const Key& key) { return key; }
+};
+
+template <>
+struct KeyStore<ArenaString> {
+    static constexpr bool arena = true;
+    typedef std::string owned_type;
+    static ArenaString intern(KeyArena * arena, const ArenaString& key) {
+        return key.interned(*arena);
+    }
+};
+#endif // _KEYS_HPP
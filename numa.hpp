@@ -0,0 +1,424 @@
+#ifndef _NUMA_HPP
+#define _NUMA_HPP
+#include "protect.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Node-local memory for NumaSlots. Memory is mapped in aligned chunks, each
+ * bound to one NUMA node with mbind(2), and carved into fixed-size blocks.
+ * Every chunk keeps its own free list and count of live blocks, and is
+ * unmapped once its last block is freed (unless it is the only one with
+ * room left). Binding is best effort: without NUMA support (or on one node)
+ * the blocks are ordinary anonymous memory.
+ *
+ * Each thread stashes up to `2 * stash_batch` free blocks per node and size,
+ * and only takes a pool's lock to move `stash_batch` of them at a time, so
+ * most allocations and frees are lock-free. A block may be freed by another
+ * thread than the one that allocated it. Stashed blocks keep their chunks
+ * mapped, and go back to the pools when their thread exits.
+ */
+class NumaArena {
+public:
+    /* Number of NUMA nodes on the host, at least 1 */
+    static int nodes() {
+        static const int n = count_nodes();
+        return n;
+    }
+
+    /* The node of the calling thread, sampled again every `resample` calls
+     * since the scheduler may move it. Until then a migrated thread keeps
+     * reading the copies of its old node, which is correct but remote, so
+     * threads that should always read node-local copies must be pinned to
+     * the CPUs of one node (e.g. with numactl --cpunodebind).
+     */
+    static int local_node() {
+        static thread_local int node = current_node();
+        static thread_local unsigned calls = 0;
+        if (++calls == resample) {
+            calls = 0;
+            node = current_node();
+        }
+        return node;
+    }
+
+    /* A block of `Bytes` bytes (64-byte aligned) on `node` */
+    template <size_t Bytes>
+    static void * alloc(const int node) {
+        Stash<Bytes>& s = stash<Bytes>();
+        if (node >= stash_nodes || !s.enlist())
+            return pool<Bytes>(node).get();
+        auto &list = s.lists[node];
+        if (0 == list.count)
+            pool<Bytes>(node).get_batch(list, stash_batch);
+        void * p = list.head;
+        list.head = *static_cast<void **>(p);
+        --list.count;
+        return p;
+    }
+    template <size_t Bytes>
+    static void free(const int node, void * p) {
+        Stash<Bytes>& s = stash<Bytes>();
+        if (node >= stash_nodes || !s.enlist())
+            return pool<Bytes>(node).put(p);
+        auto &list = s.lists[node];
+        *static_cast<void **>(p) = list.head;
+        list.head = p;
+        if (++list.count == 2 * stash_batch)
+            pool<Bytes>(node).put_batch(list, stash_batch);
+    }
+
+private:
+    static constexpr size_t chunk_bytes = size_t(1) << 20;
+    static constexpr unsigned resample = 1024;
+    static constexpr unsigned stash_batch = 32;
+    static constexpr int stash_nodes = 8;   // higher nodes are not stashed
+
+    /* A thread's free blocks, linked through their first word */
+    struct FreeList {
+        void * head;
+        unsigned count;
+    };
+
+    /* Header at the start of every chunk */
+    struct alignas(64) Chunk {
+        Chunk * prev;
+        Chunk * next;
+        void * free;        // freed blocks
+        char * bump;        // start of the never-used tail
+        size_t live;
+    };
+
+    template <size_t Bytes>
+    class Pool {
+    public:
+        explicit Pool(const int node) : _node(node) { }
+
+        void * get() {
+            std::lock_guard<std::mutex> guard(_lock);
+            return take();
+        }
+        void put(void * p) {
+            std::lock_guard<std::mutex> guard(_lock);
+            give(p);
+        }
+
+        /* Move `n` blocks into, or out of, a thread's stash */
+        void get_batch(FreeList& list, const unsigned n) {
+            std::lock_guard<std::mutex> guard(_lock);
+            for (unsigned i = 0; i < n; ++i) {
+                void * p = take();
+                *static_cast<void **>(p) = list.head;
+                list.head = p;
+                ++list.count;
+            }
+        }
+        void put_batch(FreeList& list, const unsigned n) {
+            std::lock_guard<std::mutex> guard(_lock);
+            for (unsigned i = 0; i < n && nullptr != list.head; ++i) {
+                void * p = list.head;
+                list.head = *static_cast<void **>(p);
+                --list.count;
+                give(p);
+            }
+        }
+
+    private:
+        static constexpr size_t block = (Bytes + 63) / 64 * 64;
+        static constexpr size_t capacity =
+                (chunk_bytes - sizeof(Chunk)) / block;
+        static_assert(block >= sizeof(void *) && capacity >= 2,
+                      "unsupported NUMA block size");
+
+        std::mutex _lock;
+        const int _node;
+        Chunk * _partial = nullptr;     // chunks with room left
+
+        void * take() {
+            if (nullptr == _partial)
+                link(map_chunk());
+            Chunk * c = _partial;
+            void * p;
+            if (nullptr != c->free) {
+                p = c->free;
+                c->free = *static_cast<void **>(p);
+            }
+            else {
+                p = c->bump;
+                c->bump += block;
+            }
+            ++c->live;
+            if (full(c))
+                unlink(c);
+            return p;
+        }
+
+        void give(void * p) {
+            Chunk * c = reinterpret_cast<Chunk *>(
+                    reinterpret_cast<uintptr_t>(p) & ~(chunk_bytes - 1));
+            const bool was_full = full(c);
+            *static_cast<void **>(p) = c->free;
+            c->free = p;
+            --c->live;
+            if (was_full)
+                link(c);
+            if (0 == c->live && (c != _partial || nullptr != c->next)) {
+                unlink(c);
+                munmap(c, chunk_bytes);
+            }
+        }
+
+        static bool full(const Chunk * c) { return c->live == capacity; }
+
+        void link(Chunk * c) {
+            c->prev = nullptr;
+            c->next = _partial;
+            if (nullptr != _partial)
+                _partial->prev = c;
+            _partial = c;
+        }
+        void unlink(Chunk * c) {
+            if (nullptr != c->prev)
+                c->prev->next = c->next;
+            else
+                _partial = c->next;
+            if (nullptr != c->next)
+                c->next->prev = c->prev;
+        }
+
+        /* A chunk-aligned chunk, trimmed from a mapping twice its size */
+        Chunk * map_chunk() {
+            void * m = mmap(nullptr, 2 * chunk_bytes, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (MAP_FAILED == m)
+                throw std::bad_alloc();
+            const uintptr_t base = reinterpret_cast<uintptr_t>(m);
+            const uintptr_t start = (base + chunk_bytes - 1) & ~(chunk_bytes - 1);
+            if (start != base)
+                munmap(m, start - base);
+            munmap(reinterpret_cast<void *>(start + chunk_bytes),
+                   base + chunk_bytes - start);
+            void * p = reinterpret_cast<void *>(start);
+
+            if (nodes() > 1) {
+                // Bound before first touch, so pages fault in on `_node`
+                std::vector<unsigned long> mask(_node / (8 * sizeof(long)) + 1);
+                mask[_node / (8 * sizeof(long))] |=
+                        1ul << (_node % (8 * sizeof(long)));
+                syscall(SYS_mbind, p, chunk_bytes, MPOL_BIND, mask.data(),
+                        mask.size() * 8 * sizeof(long) + 1, 0);
+            }
+            Chunk * c = static_cast<Chunk *>(p);
+            c->free = nullptr;
+            c->bump = static_cast<char *>(p) + sizeof(Chunk);
+            c->live = 0;
+            return c;
+        }
+    };
+
+    template <size_t Bytes>
+    static Pool<Bytes>& pool(const int node) {
+        // One pool per node, created once and never destroyed, since nodes
+        // may still be freed from other static destructors
+        static std::vector<Pool<Bytes> *> * pools = [] {
+            auto * v = new std::vector<Pool<Bytes> *>;
+            for (int n = 0; n < nodes(); ++n)
+                v->push_back(new Pool<Bytes>(n));
+            return v;
+        }();
+        return *(*pools)[node];
+    }
+
+    /* Trivially destructible, so it can still be reached after its thread's
+     * destructors have run: from then on frees go straight to the pools.
+     */
+    template <size_t Bytes>
+    struct Stash {
+        FreeList lists[stash_nodes];
+        bool enlisted;
+        bool exited;
+
+        /* Arrange for the stash to be emptied at thread exit; false once
+         * that has happened */
+        bool enlist() {
+            if (!enlisted) {
+                enlisted = true;
+                static thread_local Drain drain;
+                (void)drain;
+            }
+            return !exited;
+        }
+
+        struct Drain {
+            ~Drain() {
+                Stash& s = stash<Bytes>();
+                s.exited = true;
+                for (int n = 0; n < stash_nodes && n < nodes(); ++n)
+                    pool<Bytes>(n).put_batch(s.lists[n], s.lists[n].count);
+            }
+        };
+    };
+
+    template <size_t Bytes>
+    static Stash<Bytes>& stash() {
+        static thread_local Stash<Bytes> s;
+        return s;
+    }
+
+    /* One more than the highest node listed as online, e.g. "0-1" */
+    static int count_nodes() {
+        std::ifstream in("/sys/devices/system/node/online");
+        std::string list;
+        if (!(in >> list))
+            return 1;
+        const size_t sep = list.find_last_of("-,");
+        const int last = std::atoi(list.c_str() +
+                                   (std::string::npos == sep ? 0 : sep + 1));
+        return last >= 0 ? last + 1 : 1;
+    }
+
+    static int current_node() {
+        unsigned cpu = 0, node = 0;
+        if (0 != syscall(SYS_getcpu, &cpu, &node, nullptr))
+            return 0;
+        return int(node) < nodes() ? int(node) : 0;
+    }
+};
+
+
+/* Replicated slots whose `2F+1` copies live in separate rows spread across
+ * NUMA nodes: row `r` is allocated on node `r % nodes()`. The fast path reads
+ * the row on the reading thread's own node (`local_node() % copies`), while
+ * `vote` still compares every row. Each row is its own allocation, so a
+ * fault confined to one node's memory touches at most one copy of any slot
+ * and is correctable whenever F >= 1. The row pointers are themselves kept
+ * `2F+1` times in the node and voted before any row is.
+ *
+ * Following a child costs one more dependent load than ReplicatedSlots (the
+ * row pointer, which shares the node's cache line), in exchange for the slot
+ * itself being node-local. Like the other policies (see protect.hpp), the
+ * rows are read alongside a writer under a SlotSeq, and every row's copy is
+ * stored with release order, since any of them may be some thread's primary.
+ */
+template <class P, size_t N, unsigned FT>
+class NumaSlots {
+public:
+    static constexpr unsigned copies = 2 * FT + 1;
+    static constexpr size_t bytes =
+            copies * N * sizeof(P) + copies * copies * sizeof(P *);
+
+    NumaSlots() {
+        for (unsigned r = 0; r < copies; ++r) {
+            P * row = static_cast<P *>(NumaArena::alloc<row_bytes>(home(r)));
+            for (size_t i = 0; i < N; ++i)
+                row[i] = nullptr;
+            rows[r].fill(row);
+        }
+    }
+    NumaSlots(const NumaSlots& other) : NumaSlots() { *this = other; }
+    NumaSlots(NumaSlots&& other) : rows(other.rows) {
+        for (auto &row : other.rows)
+            row.fill(nullptr);
+    }
+    NumaSlots& operator=(const NumaSlots& other) {
+        for (unsigned r = 0; r < copies; ++r)
+            for (size_t i = 0; i < N; ++i)
+                rows[r][0][i] = other.rows[r][0][i];
+        return *this;
+    }
+    NumaSlots& operator=(NumaSlots&& other) {
+        std::swap(rows, other.rows);
+        return *this;
+    }
+    ~NumaSlots() {
+        for (unsigned r = 0; r < copies; ++r) {
+            try {
+                ptrvoter(rows[r]);
+            }
+            catch (const std::runtime_error&) {
+                continue;       // leak the row rather than free a bad pointer
+            }
+            if (nullptr != rows[r][0])
+                NumaArena::free<row_bytes>(home(r), rows[r][0]);
+        }
+    }
+
+    P get(const size_t i) const {
+        return SlotSeq::acquire(rows[NumaArena::local_node() % copies][0][i]);
+    }
+    void set(const size_t i, P p) {
+        seq.lock();
+        for (unsigned r = 0; r < copies; ++r)
+            SlotSeq::store(rows[r][0][i], p);
+        seq.unlock();
+    }
+    P vote(const size_t i) {
+        while (true) {
+            // The row pointers are voted to find the rows to read
+            const uint32_t s = seq.read_begin();
+            std::array<std::array<P *, copies>, copies> ptrs, vptrs;
+            std::array<P, copies> seen;
+            try {
+                for (unsigned r = 0; r < copies; ++r) {
+                    for (unsigned k = 0; k < copies; ++k)
+                        ptrs[r][k] = SlotSeq::load(rows[r][k]);
+                    vptrs[r] = ptrs[r];
+                    ptrvoter(vptrs[r]);
+                    seen[r] = SlotSeq::load(vptrs[r][0][i]);
+                }
+            }
+            catch (const std::runtime_error&) {
+                if (seq.read_end(s))
+                    throw;
+                continue;
+            }
+            if (!seq.read_end(s))
+                continue;
+
+            /* Rows are written back only where the vote changed them:
+             * storing to rows that already agree would pull every node's
+             * cache line away from its readers on each vote */
+            std::array<P, copies> slot = seen;
+            voter(slot);
+            if (slot == seen && vptrs == ptrs)
+                return slot[0];
+            if (!seq.try_lock(s))
+                continue;
+            for (unsigned r = 0; r < copies; ++r) {
+                for (unsigned k = 0; k < copies; ++k)
+                    if (ptrs[r][k] != vptrs[r][k])
+                        SlotSeq::store(rows[r][k], vptrs[r][k]);
+                if (seen[r] != slot[r])
+                    SlotSeq::store(vptrs[r][0][i], slot[r]);
+            }
+            seq.unlock();
+            return slot[0];
+        }
+    }
+    P& raw(const size_t i, const unsigned copy) { return rows[copy][0][i]; }
+
+private:
+    static constexpr size_t row_bytes = N * sizeof(P);
+    /* `rows[r][k]` is copy `k` of the pointer to row `r` */
+    std::array<std::array<P *, copies>, copies> rows;
+    SlotSeq seq;
+    static constexpr Voter<std::array<P, copies>, FT> voter =
+                                            Voter<std::array<P, copies>, FT>();
+    static constexpr Voter<std::array<P *, copies>, FT> ptrvoter =
+                                            Voter<std::array<P *, copies>, FT>();
+
+    static int home(const unsigned r) { return r % NumaArena::nodes(); }
+};
+#endif // _NUMA_HPP
@@ -0,0 +1,455 @@
+#ifndef _PROTECT_HPP
+#define _PROTECT_HPP
+#include "voter.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <thread>
+
+/* Protection policies for a node's array of `N` child pointers, selected by
+ * ReliableHAMT's `Protect` template parameter. A policy provides
+ *
+ *   P    get(i)          unchecked read of slot i, used on the fast path
+ *   void set(i, p)       write slot i, updating all redundant data (after
+ *                        correcting any it is derived from)
+ *   P    vote(i)         check and repair slot i; throws std::runtime_error
+ *                        if the damage is beyond what the policy can correct
+ *   P&   raw(i, copy)    direct access to a stored copy (fault injection)
+ *   copies               number of stored copies of each slot
+ *   bytes                bytes of slot data and redundancy per array
+ *
+ * NumaSlots (numa.hpp) is a third policy, spreading the copies across NUMA
+ * nodes.
+ *
+ * One thread may `set` while others `get` and `vote`. `set` stores the
+ * primary copy last and with release order, and `get` loads it with acquire
+ * order, so a reader that follows a new pointer sees the node it points to.
+ * `vote` reads the copies under a SlotSeq and only writes the array when it
+ * has something to repair.
+ */
+
+
+/* Sequence lock over a policy's stored words. Writers (`set`, and votes that
+ * repair) make the count odd while they store and even again after. A
+ * reader copies the words between two loads of an even count, and tries the
+ * copy again if the count changed, so it never votes on a half-written slot
+ * nor "repairs" it back to the old value. A reader that finds damage
+ * repairs it only if it can take the lock at the count its copy was made
+ * under, i.e. if nothing was written since.
+ */
+class SlotSeq {
+public:
+    SlotSeq() = default;
+    // Copies of an array are made by one thread, and start unlocked
+    SlotSeq(const SlotSeq&) { }
+    SlotSeq& operator=(const SlotSeq&) { return *this; }
+
+    uint32_t read_begin() const {
+        uint32_t s;
+        while ((s = seq.load(std::memory_order_acquire)) & 1)
+            std::this_thread::yield();
+        return s;
+    }
+    bool read_end(const uint32_t s) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return seq.load(std::memory_order_relaxed) == s;
+    }
+    bool try_lock(uint32_t s) {
+        if (!seq.compare_exchange_strong(s, s + 1, std::memory_order_acquire))
+            return false;
+        std::atomic_thread_fence(std::memory_order_release);
+        return true;
+    }
+    void lock() {
+        while (!try_lock(read_begin())) ;
+    }
+    void unlock() { seq.fetch_add(1, std::memory_order_release); }
+
+    /* Word access for the policies: plain words, so that `raw` still hands
+     * out references to them, loaded and stored atomically */
+    template <class W>
+    static W load(const W& w) { return __atomic_load_n(&w, __ATOMIC_RELAXED); }
+    template <class W>
+    static W acquire(const W& w) { return __atomic_load_n(&w, __ATOMIC_ACQUIRE); }
+    template <class W>
+    static void store(W& w, const W v) { __atomic_store_n(&w, v, __ATOMIC_RELEASE); }
+
+private:
+    std::atomic<uint32_t> seq{0};
+};
+
+
+/* Every slot is stored `2F+1` times and repaired by majority vote */
+template <class P, size_t N, unsigned FT>
+class ReplicatedSlots {
+public:
+    static constexpr unsigned copies = 2 * FT + 1;
+    static constexpr size_t bytes = N * copies * sizeof(P);
+
+    ReplicatedSlots() {
+        for (auto &slot : slots)
+            slot.fill(nullptr);
+    }
+    ReplicatedSlots(const ReplicatedSlots& other) { *this = other; }
+    ReplicatedSlots& operator=(const ReplicatedSlots& other) {
+        for (size_t i = 0; i < N; ++i)
+            slots[i] = other.slots[i];
+        return *this;
+    }
+
+    P get(const size_t i) const { return SlotSeq::acquire(slots[i][0]); }
+    void set(const size_t i, P p) {
+        seq.lock();
+        for (unsigned c = copies; c-- > 0; )
+            SlotSeq::store(slots[i][c], p);
+        seq.unlock();
+    }
+    P vote(const size_t i) {
+        while (true) {
+            const uint32_t s = seq.read_begin();
+            std::array<P, copies> seen;
+            for (unsigned c = 0; c < copies; ++c)
+                seen[c] = SlotSeq::load(slots[i][c]);
+            if (!seq.read_end(s))
+                continue;
+            std::array<P, copies> voted = seen;
+            voter(voted);
+            if (voted == seen)
+                return voted[0];
+            if (!seq.try_lock(s))
+                continue;
+            for (unsigned c = copies; c-- > 0; )
+                if (seen[c] != voted[c])
+                    SlotSeq::store(slots[i][c], voted[c]);
+            seq.unlock();
+            return voted[0];
+        }
+    }
+    P& raw(const size_t i, const unsigned copy) { return slots[i][copy]; }
+
+private:
+    std::array<P, copies> slots[N];
+    SlotSeq seq;
+    static constexpr Voter<std::array<P, copies>, FT> voter =
+                                            Voter<std::array<P, copies>, FT>();
+};
+
+
+/* Arithmetic in GF(2^64), reduced by x^64 + x^4 + x^3 + x + 1 */
+struct GF64 {
+    static constexpr uint64_t poly = 0x1B;
+
+    /* Multiply by the generator `x` */
+    static uint64_t mulx(const uint64_t a) {
+        return (a << 1) ^ ((a >> 63) ? poly : 0);
+    }
+
+    static uint64_t mul(uint64_t a, uint64_t b) {
+        uint64_t r = 0;
+        while (b) {
+            if (b & 1)
+                r ^= a;
+            b >>= 1;
+            a = mulx(a);
+        }
+        return r;
+    }
+
+    /* a^(2^64 - 2), the multiplicative inverse of a non-zero `a` */
+    static uint64_t inv(uint64_t a) {
+        uint64_t r = 1;
+        for (uint64_t e = ~uint64_t(1); e; e >>= 1) {
+            if (e & 1)
+                r = mul(r, a);
+            a = mul(a, a);
+        }
+        return r;
+    }
+
+    /* Solve the leading `n` x `n` system A x = b in place (x is left in b).
+     * Returns false if the system is singular.
+     */
+    template <size_t M>
+    static bool solve(std::array<std::array<uint64_t, M>, M> A,
+                      std::array<uint64_t, M>& b, const size_t n) {
+        for (size_t col = 0; col < n; ++col) {
+            size_t piv = col;
+            while (piv < n && 0 == A[piv][col])
+                ++piv;
+            if (piv == n)
+                return false;
+            std::swap(A[piv], A[col]);
+            std::swap(b[piv], b[col]);
+
+            const uint64_t s = inv(A[col][col]);
+            for (size_t c = col; c < n; ++c)
+                A[col][c] = mul(A[col][c], s);
+            b[col] = mul(b[col], s);
+
+            for (size_t r = 0; r < n; ++r) {
+                const uint64_t f = A[r][col];
+                if (r == col || 0 == f)
+                    continue;
+                for (size_t c = col; c < n; ++c)
+                    A[r][c] ^= mul(f, A[col][c]);
+                b[r] ^= mul(f, b[col]);
+            }
+        }
+        return true;
+    }
+};
+
+
+/* Every slot is stored once. The array is protected as a whole by `2F`
+ * Reed-Solomon check words over GF(2^64), treating each pointer as one
+ * symbol, so any `F` corrupted words among the slots and check words can be
+ * corrected. At FT=1 this costs N+2 words per node instead of 3N.
+ *
+ * Writes update the check words incrementally. `vote` and `set` first
+ * compute the syndromes (a few shifts and XORs per word) and only run the
+ * decoder when they are non-zero. `vote` computes them over a copy of the
+ * array taken under the SlotSeq, so a concurrent `set` is never mistaken
+ * for damage.
+ */
+template <class P, size_t N, unsigned FT>
+class ReedSolomonSlots {
+    static_assert(sizeof(P) == sizeof(uint64_t),
+            "Reed-Solomon slots require 64-bit symbols");
+
+public:
+    static constexpr unsigned copies = 1;
+    static constexpr size_t bytes =
+            (N + (FT ? 2 * FT : 1)) * sizeof(uint64_t);
+
+    ReedSolomonSlots() {
+        // The all-zero codeword is valid, so empty slots need no encoding
+        slots.fill(nullptr);
+        check.fill(0);
+    }
+    ReedSolomonSlots(const ReedSolomonSlots& other)
+        : slots(other.slots), check(other.check) { }
+    ReedSolomonSlots& operator=(const ReedSolomonSlots& other) {
+        slots = other.slots;
+        check = other.check;
+        return *this;
+    }
+
+    P get(const size_t i) const { return SlotSeq::acquire(slots[i]); }
+
+    /* The check words are updated by the difference from the stored word,
+     * so that word is corrected first: a fault in it would otherwise be
+     * folded into the check words, and the next vote would "correct" the
+     * new value by it.
+     */
+    void set(const size_t i, P p) {
+        seq.lock();
+        try {
+            repair(codeword());
+        }
+        catch (const std::runtime_error&) {
+            seq.unlock();
+            throw;
+        }
+        const uint64_t delta = word(slots[i]) ^ word(p);
+        const auto &g = code().gen[i];
+        for (unsigned m = 0; m < nchk; ++m)
+            SlotSeq::store(check[m], check[m] ^ GF64::mul(delta, g[m]));
+        SlotSeq::store(slots[i], p);
+        seq.unlock();
+    }
+
+    P vote(const size_t i) {
+        while (true) {
+            const uint32_t s = seq.read_begin();
+            const Codeword c = codeword();
+            if (!seq.read_end(s))
+                continue;
+            if (clean(c))
+                return reinterpret_cast<P>(c[i]);
+            if (!seq.try_lock(s))
+                continue;
+            try {
+                repair(c);
+            }
+            catch (const std::runtime_error&) {
+                seq.unlock();
+                throw;
+            }
+            const P p = slots[i];
+            seq.unlock();
+            return p;
+        }
+    }
+
+    P& raw(const size_t i, const unsigned copy) {
+        (void)copy;
+        return slots[i];
+    }
+
+private:
+    static constexpr unsigned nchk = 2 * FT;
+    /* Codeword length: the slots followed by the check words */
+    static constexpr size_t n = N + nchk;
+    static constexpr size_t dim = nchk ? nchk : 1;
+    using Syndromes = std::array<uint64_t, dim>;
+    using Matrix = std::array<std::array<uint64_t, dim>, dim>;
+    using Codeword = std::array<uint64_t, n>;
+
+    std::array<P, N> slots;
+    std::array<uint64_t, dim> check;
+    SlotSeq seq;
+
+    static uint64_t word(P p) { return reinterpret_cast<uint64_t>(p); }
+
+    /* The stored slots and check words, loaded one by one */
+    Codeword codeword() const {
+        Codeword c;
+        for (size_t j = 0; j < n; ++j)
+            c[j] = j < N ? word(SlotSeq::load(slots[j]))
+                         : SlotSeq::load(check[j - N]);
+        return c;
+    }
+    void flip(const size_t j, const uint64_t e) {
+        if (j < N)
+            SlotSeq::store(slots[j], reinterpret_cast<P>(word(slots[j]) ^ e));
+        else
+            SlotSeq::store(check[j - N], check[j - N] ^ e);
+    }
+
+    /* Per-slot encoding coefficients: writing `d` into slot i adds
+     * d * gen[i][m] to check word m, which keeps every syndrome zero.
+     */
+    struct Code {
+        std::array<std::array<uint64_t, dim>, N> gen;
+        Code() {
+            for (size_t i = 0; i < N; ++i) {
+                // Solve sum_m a^(k(N+m)) g[m] = a^(ki) for k < 2F
+                Matrix V;
+                std::array<uint64_t, dim> g;
+                for (unsigned k = 0; k < nchk; ++k) {
+                    g[k] = pow_alpha(k * i);
+                    for (unsigned m = 0; m < nchk; ++m)
+                        V[k][m] = pow_alpha(k * (N + m));
+                }
+                GF64::solve(V, g, nchk);
+                gen[i] = g;
+            }
+        }
+    };
+    static const Code& code() {
+        static const Code c;
+        return c;
+    }
+
+    static uint64_t pow_alpha(size_t e) {
+        uint64_t r = 1;
+        while (e--)
+            r = GF64::mulx(r);
+        return r;
+    }
+
+    static bool clean(const Codeword& c) {
+        if constexpr (0 == FT)
+            return true;
+        for (auto sk : syndromes(c))
+            if (sk)
+                return false;
+        return true;
+    }
+
+    /* Correct the array, of which `c` is the current content, if any
+     * syndrome is non-zero. The caller holds the lock. */
+    void repair(const Codeword& c) {
+        if constexpr (FT > 0) {
+            Syndromes s = syndromes(c);
+            for (auto sk : s) {
+                if (sk) {
+                    correct(s);
+                    break;
+                }
+            }
+        }
+    }
+
+    /* S_k = sum_j c_j a^(kj), evaluated by Horner's rule. Multiplying by
+     * a^k is k shifts, so checking the whole array is cheap.
+     */
+    static Syndromes syndromes(const Codeword& c) {
+        Syndromes s;
+        for (unsigned k = 0; k < nchk; ++k) {
+            uint64_t acc = 0;
+            for (size_t j = n; j-- > 0; ) {
+                for (unsigned r = 0; r < k; ++r)
+                    acc = GF64::mulx(acc);
+                acc ^= c[j];
+            }
+            s[k] = acc;
+        }
+        return s;
+    }
+
+    /* Peterson-Gorenstein-Zierler decoding: find the error locator from the
+     * syndromes, locate the errors by trying every position, then solve for
+     * the error values. The result is re-checked before it is kept.
+     */
+    void correct(const Syndromes& s) {
+        for (unsigned v = FT; v > 0; --v) {
+            // sum_{i=1..v} L_i S_(j+v-i) = S_(j+v), for j < v
+            Matrix A;
+            std::array<uint64_t, dim> lambda;
+            for (unsigned j = 0; j < v; ++j) {
+                for (unsigned i = 1; i <= v; ++i)
+                    A[j][i-1] = s[j + v - i];
+                lambda[j] = s[j + v];
+            }
+            if (!GF64::solve(A, lambda, v))
+                continue;
+
+            // Error positions are the X = a^p with X^v + L_1 X^(v-1) + ... = 0
+            std::array<size_t, dim> pos;
+            std::array<uint64_t, dim> loc;
+            unsigned found = 0;
+            uint64_t X = 1;
+            for (size_t p = 0; p < n; ++p, X = GF64::mulx(X)) {
+                uint64_t acc = 1;
+                for (unsigned i = 0; i < v; ++i)
+                    acc = GF64::mul(acc, X) ^ lambda[i];
+                if (0 == acc && found < v) {
+                    pos[found] = p;
+                    loc[found++] = X;
+                }
+            }
+            if (found != v)
+                break;
+
+            // sum_l e_l X_l^k = S_k, for k < v
+            Matrix B;
+            std::array<uint64_t, dim> e;
+            for (unsigned k = 0; k < v; ++k) {
+                for (unsigned l = 0; l < v; ++l) {
+                    uint64_t xk = 1;
+                    for (unsigned r = 0; r < k; ++r)
+                        xk = GF64::mul(xk, loc[l]);
+                    B[k][l] = xk;
+                }
+                e[k] = s[k];
+            }
+            if (!GF64::solve(B, e, v))
+                break;
+
+            for (unsigned l = 0; l < v; ++l)
+                flip(pos[l], e[l]);
+            for (auto sk : syndromes(codeword())) {
+                if (sk) {
+                    for (unsigned l = 0; l < v; ++l)
+                        flip(pos[l], e[l]);
+                    throw std::runtime_error("uncorrectable child array");
+                }
+            }
+            return;
+        }
+        throw std::runtime_error("uncorrectable child array");
+    }
+};
+#endif // _PROTECT_HPP
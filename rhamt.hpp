@@ -1,36 +1,100 @@
 #ifndef _RHAMT_HPP
 #define _RHAMT_HPP
 #include "voter.hpp"
+#include "epoch.hpp"
+#include "protect.hpp"
+#include "hash.hpp"
+#include "delta.hpp"
+#include "keys.hpp"
 #include <array>
 #include <vector>
-#include <list>
+#include <memory>
+#include <mutex>
 #include <bitset>
 #include <cstdint>
+#include <cstring>
 #include <functional>
+#include <optional>
+#include <random>
 #include <stdexcept>
+#include <string>
+#include <unordered_set>
 #include <csetjmp>
 #include <csignal>
 #include <cassert>
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <thread>
+#include <tuple>
+#include <type_traits>
 
 template<class Key, class T, unsigned FT = 0, class HashType = uint32_t,
-         class Hash = std::hash<Key>, class Pred = std::equal_to<Key>,
-         class Alloc = std::allocator<std::pair<const Key, T>>>
+         class Hash = MixHash<Key>, class Pred = std::equal_to<Key>,
+         class Alloc = std::allocator<std::pair<const Key, T>>,
+         template <class, size_t, unsigned> class Protect = ReplicatedSlots>
 class Injector;
 
-std::jmp_buf env;
-[[noreturn]] void sigsegv_handler(int signal) {
-    if (SIGSEGV == signal) {
+/* Whether `Hash` and `Pred` both accept keys of other types */
+template <class Hash, class Pred, class = void>
+struct is_transparent_pair : std::false_type { };
+template <class Hash, class Pred>
+struct is_transparent_pair<Hash, Pred,
+        std::void_t<typename Hash::is_transparent,
+                    typename Pred::is_transparent>> : std::true_type { };
+
+template<class Key, class T, unsigned FT = 0, class HashType = uint32_t,
+         class Hash = MixHash<Key>, class Pred = std::equal_to<Key>,
+         class Alloc = std::allocator<std::pair<const Key, T>>,
+         template <class, size_t, unsigned> class Protect = ReplicatedSlots>
+class FrozenReliableHAMT;
+
+/* Recovery point for the fast path. Each thread keeps its own, and it is only
+ * armed while that thread is inside a fast traversal, so a fault raised
+ * anywhere else (or on another thread) still gets the default action.
+ */
+thread_local std::jmp_buf env;
+thread_local volatile std::sig_atomic_t env_armed = 0;
+
+void sigsegv_handler(int signal) {
+    if (SIGSEGV == signal && env_armed) {
+        env_armed = 0;
         longjmp(env, 1);
     }
+    else if (SIGSEGV == signal) {
+        // Not our fault: restore the default action and let it re-trigger
+        std::signal(SIGSEGV, SIG_DFL);
+    }
     else {
         exit(1);
     }
 }
 
+/* The handler stays installed for the life of the process; installing it per
+ * operation is two system calls per access and is not safe once several
+ * threads are traversing at the same time.
+ */
+bool install_sigsegv_handler() {
+    struct sigaction sa = {};
+    sa.sa_handler = sigsegv_handler;
+    sa.sa_flags = SA_NODEFER;
+    sigemptyset(&sa.sa_mask);
+    if (0 != sigaction(SIGSEGV, &sa, NULL)) {
+        perror("sigaction");
+        exit(1);
+    }
+    return true;
+}
+
+/* `Protect` selects how the child pointers of each SplitNode are protected
+ * (see protect.hpp): `ReplicatedSlots` keeps 2F+1 copies and votes, while
+ * `ReedSolomonSlots` keeps one copy plus 2F check words per child array.
+ */
 template <class Key, class T, unsigned FT = 0, class HashType = uint32_t,
-          class Hash = std::hash<Key>, class Pred = std::equal_to<Key>,
-          class Alloc = std::allocator<std::pair<const Key, T>>>
+          class Hash = MixHash<Key>, class Pred = std::equal_to<Key>,
+          class Alloc = std::allocator<std::pair<const Key, T>>,
+          template <class, size_t, unsigned> class Protect = ReplicatedSlots>
 class ReliableHAMT {
 public:
     // types
@@ -44,8 +108,26 @@ public:
     typedef value_type&                                 reference;
     typedef const value_type&                           const_reference;
 
+    /* Lets `K` other than key_type through to the heterogeneous lookups */
+    template <class K>
+    using transparent_lookup = std::enable_if_t<
+            !std::is_same<std::decay_t<K>, key_type>::value &&
+            is_transparent_pair<Hash, Pred>::value>;
+
     ReliableHAMT() {};
-    ~ReliableHAMT() {};
+    /* Bulk-build from a range of key-value pairs, see `build` */
+    template <class InputIt>
+    ReliableHAMT(InputIt first, InputIt last, unsigned threads = 1)
+        { build(first, last, threads); };
+    /* Copies share every node with the original; each later write to
+     * either copies only the shared nodes on its own path. A copy takes
+     * time independent of the number of keys but not constant: it votes on
+     * and references the 32 root slots and every one of the `2^bits` root
+     * table entries, and copies the negative filter.
+     */
+    ReliableHAMT(const ReliableHAMT&);
+    ReliableHAMT& operator=(const ReliableHAMT&);
+    ~ReliableHAMT();
 
     // TODO: iterators?
     /* typedef unspecified iterator, const_iterator;
@@ -58,6 +140,12 @@ public:
     bool   empty() const;
     size_t size() const;
 
+    /* Point operations. Reads (`read`, `contains` and `get`, in all their
+     * forms below) may run on any number of threads, alongside each other
+     * and alongside one thread writing with `insert` and `remove` (see
+     * epoch.hpp). Writes must not overlap each other, nor any of the
+     * whole-trie operations further down.
+     */
     const mapped_type * insert(const key_type&, const mapped_type&);
     // int insert(const value_type&);
 
@@ -66,6 +154,264 @@ public:
 
     // mapped_type *       read(const key_type&);
     const mapped_type * read(const key_type&);
+    bool contains(const key_type& key) { return nullptr != read(key); }
+
+    /* Heterogeneous lookup, enabled when both `Hash` and `Pred` declare
+     * `is_transparent` (MixHash does for string keys, as does
+     * std::equal_to<>): a key of any type `K` they accept is hashed and
+     * compared as it is, e.g. a std::string_view against std::string keys,
+     * without building a key_type. `remove` only builds one for a key it
+     * finds, to unlink it through the usual path.
+     */
+    template <class K, class = transparent_lookup<K>>
+    const mapped_type * read(const K& key)
+        { return read_hashed(hash_of(key), key); }
+    template <class K, class = transparent_lookup<K>>
+    bool contains(const K& key) { return nullptr != read(key); }
+    template <class K, class = transparent_lookup<K>>
+    int remove(const K& key);
+
+    /* The same operations with the key's hash already computed, skipping
+     * the hasher: `hash` must be what the trie would compute, i.e.
+     * `fold_hash<hash_type>(hasher()(key))`, or the key is stored where no
+     * lookup will find it.
+     */
+    const mapped_type * insert_hashed(const hash_type& hash,
+                                      const key_type&, const mapped_type&);
+    int remove_hashed(const hash_type& hash, const key_type&);
+    const mapped_type * read_hashed(const hash_type& hash, const key_type&);
+    template <class K, class = transparent_lookup<K>>
+    const mapped_type * read_hashed(const hash_type& hash, const K& key);
+
+    /* A copy of the value for `key`, or nothing if it is absent. The
+     * pointer `read` returns may be freed by a concurrent write of the key
+     * as soon as the call returns (or, for an inline entry, rewritten in
+     * place), while this copies the value before the reading thread is
+     * unpinned, so it is the read to use alongside a writer.
+     */
+    std::optional<mapped_type> get(const key_type& key)
+        { return find_copy(hash_of(key), key); }
+    template <class K, class = transparent_lookup<K>>
+    std::optional<mapped_type> get(const K& key)
+        { return find_copy(hash_of(key), key); }
+    std::optional<mapped_type> get_hashed(const hash_type& hash,
+                                          const key_type& key)
+        { return find_copy(hash, key); }
+    template <class K, class = transparent_lookup<K>>
+    std::optional<mapped_type> get_hashed(const hash_type& hash, const K& key)
+        { return find_copy(hash, key); }
+
+    /* Insert a (forward) range of key-value pairs using up to `threads`
+     * threads. Pairs are radix-partitioned by the root-level subhash and
+     * each of the 32 root subtrees is filled by one worker, off the root,
+     * before being stitched into the root's child array. Later duplicates
+     * in the range win, as with repeated `insert`.
+     */
+    template <class InputIt>
+    void build(InputIt first, InputIt last, unsigned threads = 1);
+
+    /* Set operations with another trie of the same type, whose hasher must
+     * agree with this one's. The two tries have the same shape, so they are
+     * walked together slot by slot, voting on both as they go, and the
+     * root-level subtrees are divided among `threads` workers. Subtrees the
+     * tries share (after a copy or `merge`) are skipped without a visit.
+     * If either trie has a root table, both are processed key by key.
+     *
+     * `merge` inserts every entry of `other`, whose values win for keys in
+     * both, and returns the number of keys added. A subtree only `other`
+     * has is adopted whole: it is shared copy-on-write, not copied.
+     * `intersect` removes every key `other` lacks and returns how many.
+     * `diff` calls `fn(key, mine, theirs)` for every key held by one trie
+     * only (the other's pointer is null) or mapped to unequal values; with
+     * several threads, `fn` is called concurrently. The pointers are only
+     * valid during the call.
+     *
+     * All three may repair `other`; like any write, `merge` and `intersect`
+     * must not race with other writes to either trie.
+     */
+    size_t merge(ReliableHAMT& other, unsigned threads = 1);
+    size_t intersect(ReliableHAMT& other, unsigned threads = 1);
+    template <class Fn>
+    void diff(ReliableHAMT& other, Fn fn, unsigned threads = 1);
+
+    /* Full scans on up to `threads` threads. The trie is cut into subtrees
+     * of roughly equal key counts (by `_count`, splitting the larger root
+     * subtrees further) and each thread starts on its own run of them,
+     * taking work from the back of the others' runs once it is done. Every
+     * child array is voted on as it is visited, as in `scrub`.
+     *
+     * `parallel_for_each` calls `fn(key, value)` for every entry.
+     * `parallel_reduce` returns `map_fn` over every entry folded together
+     * with `reduce_fn(a, b)`, or a default-constructed result if the trie
+     * is empty. Results are combined in trie order whatever the number of
+     * threads, so `reduce_fn` need only be associative. All three functions
+     * are called concurrently with several threads. Like `diff`, these may
+     * run alongside reads but not writes.
+     */
+    template <class Fn>
+    void parallel_for_each(Fn fn, unsigned threads = 1);
+    template <class Map, class Reduce>
+    auto parallel_reduce(Map map_fn, Reduce reduce_fn, unsigned threads = 1)
+        -> std::decay_t<std::invoke_result_t<Map&, const key_type&,
+                                             const mapped_type&>>;
+
+    /* Order statistics over hash order, the order the scans visit keys
+     * in: by hash read five bits at a time from the low end (the subhash
+     * of each level from the root down), keys sharing a full hash in the
+     * order of their leaf. Each walks one path, voting on it, and picks
+     * its way down by the `_count`s of the children of each node on the
+     * path, which are checked against their parent's; a disagreement is
+     * settled by recounting the node's subtree, which repairs every count
+     * in it. That makes them O(depth) (each level reads the counts of its
+     * 32 slots). A root table is walked as the levels it replaces, by the
+     * key counts of its entries summed by prefix (see `_table_totals`).
+     *
+     * `nth_by_hash(i)` is the entry of rank `i`, or nothing if
+     * `i >= size()`. `rank(key)` is the number of keys before `key`, where
+     * it is or would be. `sample(rng)` is an entry drawn uniformly at
+     * random with `rng` (any UniformRandomBitGenerator), or nothing if the
+     * trie is empty. These may run alongside reads, but not writes.
+     */
+    std::optional<value_type> nth_by_hash(size_t i);
+    size_t rank(const key_type& key);
+    template <class URBG>
+    std::optional<value_type> sample(URBG& rng) {
+        const size_t n = size();
+        if (0 == n)
+            return std::nullopt;
+        return nth_by_hash(std::uniform_int_distribution<size_t>(0, n - 1)(rng));
+    }
+
+    /* Put a Bloom filter of `nbits` bits (rounded up to a power of two) in
+     * front of the root, so that most lookups of absent keys return without
+     * touching the trie. About 10 bits per key gives ~2% false positives.
+     * Removals do not clear bits; calling this again rebuilds the filter
+     * from the current contents. Passing 0 disables it.
+     */
+    void set_negative_filter(size_t nbits);
+
+    /* Replace the top `bits / 5` levels of the trie with one directly
+     * indexed table of `2^bits` protected entries, so that every operation
+     * consumes the first `bits` of the hash in one step. `bits` must be a
+     * multiple of 5 of at least 10 and leave a split level below the table
+     * (e.g. 10, 15 or 20 with 32-bit hashes); 0 goes back to a plain 32-way
+     * root. Existing subtrees are moved, not copied, and nodes shared with
+     * snapshots are left untouched.
+     */
+    void set_root_bits(const unsigned bits);
+
+    /* Cache mode: hold at most `max_keys` keys (0, the default, for no
+     * bound). Whenever an insert, `build` or `merge` leaves more, entries
+     * are evicted by CLOCK. A read marks the slot it hits; a hand sweeps the
+     * leaf-level child arrays in trie order, clearing marks as it passes,
+     * and evicts the first unmarked entries it finds. New keys start
+     * unmarked, so a key that is not read again goes first; keys sharing a
+     * full hash share a mark. The hand resumes where it stopped, so each
+     * insert beyond the capacity pays for about one eviction, and the marks
+     * a long sweep clears were paid for by the reads that set them. The
+     * entry an insert has just written is never its own victim. Evictions
+     * are removes like any other: emptied nodes are pruned and the change
+     * log records them. Lowering the capacity evicts at once; copies and
+     * snapshots keep it.
+     */
+    void set_capacity(const size_t max_keys);
+    size_t capacity() const { return _capacity; }
+
+    /* Snapshot the trie into the compact, read-only FrozenReliableHAMT
+     * (include frozen.hpp); `thaw()` on the result gives a mutable trie back.
+     */
+    FrozenReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>
+    freeze();
+
+    /* A read-only, point-in-time view of the trie, shared with it node for
+     * node (see Snapshot below). It costs what a copy does: O(1) in the
+     * number of keys, but O(2^bits) with a root table. Like any write, this
+     * must not race with other writes to the trie.
+     */
+    class Snapshot;
+    Snapshot snapshot();
+
+    /* Change log for replication. With a `capacity` > 0, every insert and
+     * every remove that removes a key (bulk loads included) is recorded in
+     * a ring of that many changes, numbered by a sequence number; a full
+     * ring drops its oldest change. 0 disables the log. Copies and
+     * snapshots of the trie start without one.
+     */
+    void set_change_log(size_t capacity);
+    /* The same, numbering the next change `seq`, e.g. to continue a journal */
+    void set_change_log(size_t capacity, uint64_t seq);
+    /* Sequence number the next logged change will get */
+    uint64_t change_seq() const { return _log_seq; }
+    /* Append the logged changes to `out` as one delta (see delta.hpp) and
+     * clear the log. Returns the number of changes written.
+     */
+    size_t drain_changes(std::string& out);
+    /* Apply a stream of deltas from another trie's `drain_changes`. `next`
+     * is the sequence number of the first change not applied yet; earlier
+     * changes are skipped, so deltas may be delivered more than once. Only
+     * the last change to each key is applied: removes one by one, inserts
+     * through `build` on `threads` threads. The whole stream is checked
+     * first, and nothing is applied if a delta is corrupt, a key does not
+     * hash here as it did on the leader, or changes are missing because
+     * they were dropped from the leader's full log (which calls for a full
+     * resync); each throws std::runtime_error. Returns the sequence number
+     * following the stream.
+     */
+    uint64_t apply_delta(const std::string& deltas, uint64_t next,
+                         unsigned threads = 1);
+
+    /* How the replicated hash of a leaf is checked on the fast path:
+     *   always   full vote on every access
+     *   replica  compare the primary with one other replica; vote if they
+     *            (or the expected hash) disagree
+     *   sampled  compare the primary with the expected hash only, with a
+     *            full vote on one in `period` accesses and on any mismatch
+     * The cheaper modes leave faults in unchecked replicas undetected until
+     * the next vote, so they should be backed by a periodic `scrub()`.
+     */
+    enum class verify { always, replica, sampled };
+    void set_verification(const verify mode, const unsigned period = 64);
+
+    /* Vote on every child array and leaf hash in the trie, repairing any
+     * correctable fault; throws std::runtime_error on an uncorrectable one.
+     * Returns the number of nodes checked.
+     */
+    size_t scrub();
+
+    /* Shape and footprint of the trie, gathered by `inspect()`. Sizes are
+     * those of the objects themselves (nodes, chain entries, the root table
+     * and filter), without allocator overhead or memory owned by keys and
+     * values. Nodes shared with snapshots are counted in full.
+     */
+    struct Stats {
+        /* Split nodes at each depth, the root at depth 0. The levels a root
+         * table replaces have none. */
+        std::vector<size_t> split_nodes;
+        /* `occupancy[k]` split nodes have `k` of their slots in use */
+        std::vector<size_t> occupancy;
+        /* `chains[n]` leaves hold `n` keys that share their full hash */
+        std::vector<size_t> chains;
+        size_t leaves = 0;
+        size_t inline_entries = 0;
+        size_t entries = 0;
+        /* Key and value bytes; redundant copies (pointer and hash replicas,
+         * check words, filter copies); everything else (the primary copies
+         * of pointers, vtables, counts, chain links)
+         */
+        size_t payload_bytes = 0;
+        size_t replica_bytes = 0;
+        size_t structure_bytes = 0;
+        /* Split nodes whose `_count` disagrees with the keys below them */
+        size_t count_mismatches = 0;
+
+        size_t total_bytes() const
+            { return payload_bytes + replica_bytes + structure_bytes; }
+        double bytes_per_key() const
+            { return entries ? double(total_bytes()) / entries : 0.0; }
+        void print(std::ostream& os) const;
+    };
+    /* Walk the whole trie, voting on the way down like `scrub()` */
+    Stats inspect();
 
 
 protected:
@@ -92,7 +438,14 @@ protected:
     void traverse_fast(const hash_type&);
     void traverse_safe(const hash_type&);
 
-    /* Virtual base class */
+    /* Virtual base class
+     *
+     * `trie` is the trie being traversed, used to restart from its root and
+     * to reach its settings. `child_count` is an out-parameter holding the
+     * number of keys the operation added (insert) or removed (remove) below
+     * the node, which each SplitNode on the way back up applies to its
+     * `_count`.
+     */
     class Node {
     public:
         enum class optype { read, remove, insert };
@@ -100,68 +453,353 @@ protected:
         virtual ~Node() {};
         virtual const mapped_type * fast_traverse(
                 const hash_type&, const key_type&, omtr, const optype,
-                const int depth, Node * root, size_t * child_count) = 0;
+                const int depth, ReliableHAMT * trie,
+                size_t * child_count) = 0;
         virtual const mapped_type * safe_traverse(
                 const hash_type&, const key_type&, omtr, const optype,
-                const int depth, Node * root, size_t * child_count) = 0;
+                const int depth, ReliableHAMT * trie,
+                size_t * child_count) = 0;
+        /* True if the subtree holds no keys and may be unlinked */
+        virtual bool is_empty() = 0;
+        /* Vote on all redundant data in the subtree, returns nodes checked */
+        virtual size_t scrub() = 0;
+        /* A private copy of this node, sharing its children */
+        virtual Node * clone() = 0;
+        /* Deleter handed to the reclaimer for retired nodes */
+        static void destroy(void * p) { delete static_cast<Node *>(p); }
+
+        /* Number of parents linking to this node, across the trie and its
+         * snapshots. A node with more than one is shared and is never
+         * written; writers copy it into their own version first.
+         */
+        std::atomic<uint32_t> _refs{1};
+        bool shared() const
+            { return _refs.load(std::memory_order_acquire) > 1; }
+    };
+
+    /* Small entries stored in place of a leaf pointer.
+     *
+     * When the key and value are trivially copyable and fit beside a tag
+     * byte in one word, an entry is kept directly in the leaf-level child
+     * slot of its SplitNode, so it is replicated (or coded) and voted on like
+     * any pointer. Node pointers are aligned, so the low bit tells the two
+     * apart. A LeafNode is only created once two keys share a full hash.
+     * The slot's path already encodes the hash, and a key match proves the
+     * path was right, so no hash is stored. Assumes little-endian words.
+     */
+    struct InlineEntry {
+        // Byte 0 is the tag; the key goes at the first aligned offset after it
+        static constexpr size_t koff = alignof(Key);
+        static constexpr size_t voff =
+                (koff + sizeof(Key) + alignof(T) - 1) / alignof(T) * alignof(T);
+        static constexpr bool enabled =
+                std::is_trivially_copyable<Key>::value &&
+                std::is_trivially_copyable<T>::value &&
+                sizeof(Node *) == sizeof(uint64_t) &&
+                voff + sizeof(T) <= sizeof(uint64_t);
+        // The tag must land in the low bit, which no real node pointer sets
+        static_assert(!enabled || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+                      "inline entries assume a little-endian layout");
+        static_assert(!enabled || alignof(Node) >= 2,
+                      "inline entries need the low bit of node pointers");
+
+        static bool is(const Node * p)
+            { return reinterpret_cast<uintptr_t>(p) & 1; }
+
+        static Node * pack(const Key& key, const T& val) {
+            unsigned char bytes[sizeof(Node *)] = { 1 };
+            std::memcpy(bytes + koff, &key, sizeof(Key));
+            std::memcpy(bytes + voff, &val, sizeof(T));
+            Node * p;
+            std::memcpy(&p, bytes, sizeof(p));
+            return p;
+        }
+        static Key key(const Node * p) {
+            Key k;
+            std::memcpy(&k, reinterpret_cast<const unsigned char *>(&p) + koff,
+                        sizeof(Key));
+            return k;
+        }
+        static T value(const Node * p) {
+            T v;
+            std::memcpy(&v, reinterpret_cast<const unsigned char *>(&p) + voff,
+                        sizeof(T));
+            return v;
+        }
+        /* The value as stored in a slot, valid until the slot is written */
+        static const T * value_ptr(Node * const & slot) {
+            return reinterpret_cast<const T *>(
+                        reinterpret_cast<const unsigned char *>(&slot) + voff);
+        }
     };
 
+    /* A protected array of child pointers */
+    using Slots = Protect<Node *, nchldrn, FT>;
+
+    /* Unlink the child in `slots[idx]` if it has become empty */
+    static void prune_slot(Slots& slots, const int idx);
+
+    /* Reference counting for nodes shared with snapshots. `acquire` takes a
+     * reference for a new parent. `unlink` drops the reference of a slot
+     * that the current operation may still be following, retiring the node
+     * if it was the last; `drop` is for a parent that is itself being
+     * freed, so the node can go at once.
+     */
+    static void acquire(Node * node);
+    static void unlink(Node * node);
+    static void drop(Node * node);
+    /* The (voted) child in `slots[idx]`, first replaced by a private copy
+     * if it is shared, so that the caller may write to it. This is the path
+     * copy: each level of a write through a shared subtree copies one node.
+     */
+    static Node * own_slot(Slots& slots, const int idx);
+
     class SplitNode : public ReliableHAMT::Node {
     public:
         /* Avoid typing long gross template type multiple times */
-        using RHAMT = ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc>;
+        using RHAMT = ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc,
+                                   Protect>;
         using optype = typename RHAMT::Node::optype;
         using omtr = std::optional<std::reference_wrapper<const mapped_type>>;
 
-        /* Redundant arrays of child pointers */
-        std::array<Node *, ft> children [nchldrn];
+        /* Protected array of child pointers */
+        Slots children;
 
         /* Number of keys stored in subtree rooted by this node */
         size_t _count;
+        /* CLOCK reference bits of the leaf-level slots, for tries with a
+         * capacity: bit `i` is set when a read hits the entry in slot `i` and
+         * cleared when an insert adds a key there or the hand passes it.
+         * They only steer eviction, so they are kept once and not voted.
+         */
+        std::atomic<uint32_t> _referenced{0};
+        /* Update the reference bit of slot `idx` after `op`, which found a
+         * value (`hit`) and added `added` keys */
+        void note_use(const int idx, const optype op, const bool hit,
+                      const size_t added) {
+            const uint32_t bit = uint32_t(1) << idx;
+            if (RHAMT::Node::optype::read == op && hit) {
+                // Test first, so that hot entries are not written on every read
+                if (!(_referenced.load(std::memory_order_relaxed) & bit))
+                    _referenced.fetch_or(bit, std::memory_order_relaxed);
+            }
+            else if (RHAMT::Node::optype::insert == op && added) {
+                _referenced.fetch_and(~bit, std::memory_order_relaxed);
+            }
+        }
         /* Calculate index of child node based on `ptrmask` */
         int getChild(const hash_type&, const int depth);
-        /* Voting object for comparing redundant data */
-        static constexpr Voter<std::array<Node *, ft>, FT> childvoter =
-                                        Voter<std::array<Node *, ft>, FT>();
-
+        /* Unlink the child at the index if it has become empty */
+        void prune(const int child_idx);
+        /* Operations on an inline entry in slot `idx` at the leaf level. The
+         * fast variant only handles a key match and otherwise recovers; the
+         * safe variant fills empty slots and moves colliding keys to a leaf.
+         */
+        const mapped_type * inline_fast(const int idx, const hash_type&,
+                const key_type&, omtr, const optype, const int depth,
+                ReliableHAMT * trie, size_t * child_count);
+        const mapped_type * inline_safe(const int idx, Node * entry,
+                const hash_type&, const key_type&, omtr, const optype,
+                ReliableHAMT * trie, size_t * child_count);
+        const mapped_type * inline_apply(const int idx, const key_type&, omtr,
+                const optype, size_t * child_count);
 
     public:
-        SplitNode() : _count(0) {
-            for (int i = 0; i < nchldrn; ++i)
-                for (int j = 0; j < ft; ++j)
-                    children[i][j] = nullptr;
-        }
+        SplitNode() : _count(0) { }
         ~SplitNode();
+        /* Make this node a copy of `src`, sharing its children */
+        void copy_from(SplitNode& src);
+        Node * clone();
         const mapped_type * fast_traverse(
             const hash_type&, const key_type&, omtr, const optype,
-            const int depth, Node * root, size_t * child_count);
+            const int depth, ReliableHAMT * trie, size_t * child_count);
         const mapped_type * safe_traverse(
             const hash_type&, const key_type&, omtr, const optype,
-            const int depth, Node * root, size_t * child_count);
+            const int depth, ReliableHAMT * trie, size_t * child_count);
+        bool is_empty();
+        size_t scrub();
 
         size_t getCount() const { return _count; };
+        /* Apply a child's reported change in key count to `_count` */
+        void update_count(const optype op, const size_t delta) {
+            if (RHAMT::Node::optype::insert == op)
+                _count += delta;
+            else if (RHAMT::Node::optype::remove == op)
+                _count -= delta;
+        }
+    };
+
+    /* A leaf's entries, as a singly linked list that readers may walk while
+     * one thread writes it. Links are stored with release order and loaded
+     * with acquire order, and an entry is never changed once linked: an
+     * overwrite links a new entry in place of the old one and a remove
+     * unlinks it, and either way the old entry is retired to the reclaimer,
+     * so a reader still on it can carry on to its successor.
+     */
+    class Chain {
+    public:
+        struct Entry {
+            value_type kv;
+            std::atomic<Entry *> next{nullptr};
+            template <class... Args>
+            Entry(Args&&... args) : kv(std::forward<Args>(args)...) { }
+        };
+
+        class iterator {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = typename ReliableHAMT::value_type;
+            using difference_type = std::ptrdiff_t;
+            using pointer = value_type *;
+            using reference = value_type&;
+
+            explicit iterator(Entry * e = nullptr) : e(e) { }
+            reference operator*() const { return e->kv; }
+            pointer operator->() const { return &e->kv; }
+            iterator& operator++() {
+                e = e->next.load(std::memory_order_acquire);
+                return *this;
+            }
+            bool operator==(const iterator& o) const { return e == o.e; }
+            bool operator!=(const iterator& o) const { return e != o.e; }
+        private:
+            Entry * e;
+        };
+
+        Chain() = default;
+        Chain(const Chain&) = delete;
+        Chain& operator=(const Chain&) = delete;
+        /* The leaf is unreachable by now, so its entries go at once */
+        ~Chain() {
+            Entry * e = head.load(std::memory_order_relaxed);
+            while (nullptr != e) {
+                Entry * next = e->next.load(std::memory_order_relaxed);
+                destroy(e);
+                e = next;
+            }
+        }
+
+        iterator begin() const
+            { return iterator(head.load(std::memory_order_acquire)); }
+        iterator end() const { return iterator(); }
+        bool empty() const
+            { return nullptr == head.load(std::memory_order_acquire); }
+        /* Kept by the writer, for the counts; readers do not need it */
+        size_t size() const { return _size; }
+
+        /* The link to the entry for `key`, or the null link at the end */
+        std::atomic<Entry *> * find(const key_type& key, const key_equal& eq) {
+            std::atomic<Entry *> * link = &head;
+            for (Entry * e; nullptr != (e = link->load(std::memory_order_relaxed));
+                    link = &e->next)
+                if (eq(e->kv.first, key))
+                    break;
+            return link;
+        }
+        /* Link a new entry where `link` points: at the end, or in place of
+         * the entry there, which is retired */
+        template <class... Args>
+        Entry * emplace(std::atomic<Entry *> * link, Args&&... args) {
+            Entry * e = make(std::forward<Args>(args)...);
+            Entry * old = link->load(std::memory_order_relaxed);
+            if (nullptr != old)
+                e->next.store(old->next.load(std::memory_order_relaxed),
+                              std::memory_order_relaxed);
+            link->store(e, std::memory_order_release);
+            if (nullptr == old)
+                ++_size;
+            else
+                retire(old);
+            return e;
+        }
+        template <class... Args>
+        Entry * emplace_back(Args&&... args) {
+            std::atomic<Entry *> * link = &head;
+            for (Entry * e; nullptr != (e = link->load(std::memory_order_relaxed));
+                    link = &e->next) ;
+            return emplace(link, std::forward<Args>(args)...);
+        }
+        /* Unlink the entry `link` points to, and retire it */
+        void erase(std::atomic<Entry *> * link) {
+            Entry * old = link->load(std::memory_order_relaxed);
+            link->store(old->next.load(std::memory_order_relaxed),
+                        std::memory_order_release);
+            --_size;
+            retire(old);
+        }
+
+    private:
+        using EntryAlloc = typename std::allocator_traits<allocator_type>::
+                template rebind_alloc<Entry>;
+        using EntryTraits = std::allocator_traits<EntryAlloc>;
+
+        std::atomic<Entry *> head{nullptr};
+        size_t _size = 0;
+
+        template <class... Args>
+        static Entry * make(Args&&... args) {
+            EntryAlloc a;
+            Entry * e = EntryTraits::allocate(a, 1);
+            try {
+                EntryTraits::construct(a, e, std::forward<Args>(args)...);
+            }
+            catch (...) {
+                EntryTraits::deallocate(a, e, 1);
+                throw;
+            }
+            return e;
+        }
+        static void destroy(void * p) {
+            EntryAlloc a;
+            Entry * e = static_cast<Entry *>(p);
+            EntryTraits::destroy(a, e);
+            EntryTraits::deallocate(a, e, 1);
+        }
+        /* As for pruning, the fault guard is dropped while the reclaimer
+         * may run, and the write it interrupts is already done */
+        static void retire(Entry * e) {
+            const std::sig_atomic_t armed = env_armed;
+            env_armed = 0;
+            EpochReclaimer::instance().retire(e, &destroy);
+            env_armed = armed;
+        }
     };
 
     class LeafNode : public ReliableHAMT::Node {
     public:
         /* Avoid typing long gross template type multiple times */
-        using RHAMT = ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc>;
+        using RHAMT = ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc,
+                                   Protect>;
         using optype = typename RHAMT::Node::optype;
         using omtr = std::optional<std::reference_wrapper<const mapped_type>>;
 
-        // Key-value store for data (expected size == 1, list in case
+        // Key-value store for data (expected size == 1, a chain in case
         // of hash collisions)
-        std::list<value_type, allocator_type> data;
+        Chain data;
         key_equal key_eq;
         std::array<hash_type, ft> hashes;
         /* Voting object for comparing redundant data */
         static constexpr Voter<std::array<hash_type, ft>, FT> hashvoter =
                                      Voter<std::array<hash_type, ft>, FT>();
-        const mapped_type * insert(const key_type&, omtr);
+        /* Vote on `hashes`, storing only the copies the vote changed, so
+         * that readers sharing an undamaged leaf never write to it */
+        void vote_hashes() {
+            std::array<hash_type, ft> voted = hashes;
+            hashvoter(voted);
+            for (int i = 0; i < ft; ++i)
+                if (hashes[i] != voted[i])
+                    hashes[i] = voted[i];
+        }
+        /* Keys are stored through `trie`'s KeyStore */
+        const mapped_type * insert(const key_type&, omtr, size_t *,
+                                   ReliableHAMT * trie);
         int remove(const key_type&, size_t *);
         const mapped_type * read(const key_type&);
         const mapped_type * apply_op(const key_type &, omtr,
-                                     size_t * ccount, const optype);
+                                     size_t * ccount, const optype,
+                                     ReliableHAMT * trie);
+        /* Check the stored hash against `hash` as the trie's mode requires */
+        bool check_hash(const hash_type&, const ReliableHAMT * trie);
     public:
         LeafNode(const hash_type& h) {
             for (int i = 0; i < ft; ++i)
@@ -171,70 +809,363 @@ protected:
 
         const mapped_type * fast_traverse(
             const hash_type&, const key_type&, omtr, const optype,
-            const int depth, Node * root, size_t * child_count);
+            const int depth, ReliableHAMT * trie, size_t * child_count);
         const mapped_type * safe_traverse(
             const hash_type&, const key_type&, omtr, const optype,
-            const int depth, Node * root, size_t * child_count);
+            const int depth, ReliableHAMT * trie, size_t * child_count);
+        bool is_empty() { return data.empty(); }
+        size_t scrub() {
+            vote_hashes();
+            return 1;
+        }
+        Node * clone() {
+            vote_hashes();
+            LeafNode * copy = new LeafNode(hashes[0]);
+            for (auto &kv : data)
+                copy->data.emplace_back(kv);
+            return copy;
+        }
+    };
+
+    /* Run an operation from the root, on the fast path (falling back to the
+     * safe path on a fault) or on the safe path. These dispatch to the root
+     * table when one is configured.
+     */
+    const mapped_type * root_fast(const hash_type&, const key_type&,
+                                  typename Node::omtr,
+                                  const typename Node::optype, size_t * ccount);
+    const mapped_type * root_safe(const hash_type&, const key_type&,
+                                  typename Node::omtr,
+                                  const typename Node::optype, size_t * ccount);
+
+    /* Root table. Entry `j` (the low `_table_bits` bits of the hash) is slot
+     * `j >> (_table_bits - 5)` of block `j & (nblocks - 1)`, so that entries
+     * sharing their first subhash share blocks and a builder thread owning
+     * one root-level subhash never writes another's block. The root
+     * SplitNode stays empty but keeps the total key count.
+     */
+    unsigned _table_bits = 0;
+    std::vector<Slots> _table;
+    Slots& table_block(const hash_type& hash, int& slot);
+    /* Key counts of the table entries summed by prefix, which stand in for
+     * the `_count`s of the levels the table replaces. Level `d` (from 1 to
+     * `bits / 5 - 1`) holds the totals of the `32^d` prefixes of `d`
+     * subhashes in hash order, from `table_level(d)` on. Like `_count`,
+     * they are kept once and checked against each other as they are used.
+     */
+    std::vector<size_t> _table_totals;
+    static size_t table_level(const int d)
+        { return ((size_t(1) << (nlog2chldrn * d)) - nchldrn) / (nchldrn - 1); }
+    /* Apply a change of `delta` keys below `hash`'s entry to the totals */
+    void table_tally(const hash_type& hash, const typename Node::optype op,
+                     const size_t delta);
+    /* Recompute the totals from the entries' counts, first recounting the
+     * entries if those do not add up to the root's count */
+    void table_retally();
+    /* The slot for `hash` without touching `_root`'s count, for the builder
+     * (whose workers own the table totals below their first subhash) */
+    const mapped_type * table_descend(const hash_type&, const key_type&,
+                                      typename Node::omtr,
+                                      const typename Node::optype,
+                                      size_t * ccount);
+    /* The root-slot half of `build`: fill each root subtree off the root */
+    template <class Buckets, class Run>
+    void build_subtrees(Buckets& buckets, const unsigned threads, Run& run);
+
+    /* Restart an operation on the safe path from the root, from within a
+     * fast traversal */
+    const mapped_type * recover(const hash_type&, const key_type&,
+                                typename Node::omtr,
+                                const typename Node::optype, size_t * ccount);
+
+    /* Negative filter. `FT+1` copies are kept: bits are only ever set, so
+     * their union still covers every stored hash with F faulty words, and a
+     * key is only reported absent when all copies agree.
+     */
+    static constexpr int filter_probes = 3;
+    std::array<std::vector<uint64_t>, FT + 1> _filter;
+    uint64_t _filter_mask = 0;
+    static uint64_t filter_probe(const hash_type, const int i);
+    bool filter_excludes(const hash_type&) const;
+    void filter_add(const hash_type&);
+
+    /* Call `fn(hash, key, value)` for every entry below `node`, voting on
+     * the way down. `prefix` holds the subhashes of the levels above.
+     */
+    template <class Fn>
+    static void for_each_entry(SplitNode * node, const int depth,
+                               const uint64_t prefix, Fn& fn);
+    /* The same for the entries of `child`, found in a slot at `depth`
+     * whose path is `path` */
+    template <class Fn>
+    static void for_each_in_slot(Node * child, const int depth,
+                                 const uint64_t path, Fn& fn);
+    /* Keys stored under `child`, found in a slot at `depth` */
+    static size_t count_in_slot(Node * child, const int depth);
+    /* Count the keys below `node`, whose slots are at `depth`, from its
+     * entries, setting `_count` on every split node in the subtree */
+    static size_t recount_node(SplitNode * node, const int depth);
+    /* Set `_count` on the split nodes of `hash`'s voted path from their
+     * children's, bottom up. Run after a fault interrupts a fast write,
+     * whose deeper frames may already have applied the change to their
+     * counts where the safe retry finds nothing left to do.
+     */
+    void recount_path(const hash_type& hash);
+
+    /* For the order statistics: the voted children of `node`, whose slots
+     * are at `depth`, and their key counts, which are first made to agree
+     * with `node->_count`; returns the total */
+    static size_t slot_counts(SplitNode * node, const int depth,
+                              std::array<Node *, nchldrn>& kids,
+                              std::array<size_t, nchldrn>& counts);
+    /* The same for the root table seen as the levels it replaces: the
+     * children of the prefix `p` of `d` subhashes, which are the prefixes
+     * one subhash longer (with null `kids`) or, at the last level, table
+     * entries. Returns false if their counts do not add up to the prefix's
+     * total (the root's count for the empty prefix).
+     */
+    bool table_children(const int d, const size_t p,
+                        std::array<Node *, nchldrn>& kids,
+                        std::array<size_t, nchldrn>& counts);
+    /* Position in hash order of the root table entry for `hash` */
+    size_t table_order(const hash_type& hash) const;
+    /* The hash of the root table entry at position `m` in hash order */
+    hash_type table_hash(const size_t m) const;
+    /* The same over the whole trie, root table included */
+    template <class Fn>
+    void for_each_entry(Fn& fn);
+
+    /* The hasher's result folded down to `hash_type`; every entry point
+     * hashes through here so that all of them agree on a key's path.
+     */
+    template <class K>
+    hash_type hash_of(const K& key) const
+        { return fold_hash<HashType>(hasher_function(key)); }
+
+    /* `read_hashed` for a key of another type. The virtual traversal only
+     * takes key_type, so this walks the same path by depth: primary copies
+     * first, under the fault guard and leaf hash check, and a voted descent
+     * from the root if anything looks wrong. An inline entry that matches
+     * is also stored in `entry`, if given, for its value to be decoded from
+     * the word read rather than from the slot.
+     */
+    template <class K>
+    const mapped_type * find_fast(const hash_type&, const K&,
+                                  Node ** entry = nullptr);
+    template <class K>
+    const mapped_type * find_safe(const hash_type&, const K&,
+                                  Node ** entry = nullptr);
+    /* `get_hashed`, for any key type `find_fast` takes */
+    template <class K>
+    std::optional<mapped_type> find_copy(const hash_type&, const K&);
+
+    /* The set operations on a pair of aligned split nodes at `depth`, as
+     * run below each root slot. `merge_nodes` and `intersect_nodes` keep
+     * `mine`'s count up to date and return the keys they added or removed;
+     * `note(hash, key, value)` is told of every entry written and `gone`
+     * of every key removed, for the filter and change log.
+     */
+    template <class Note>
+    size_t merge_nodes(SplitNode * mine, SplitNode * theirs, const int depth,
+                       const uint64_t prefix, Note& note);
+    template <class Gone>
+    size_t intersect_nodes(SplitNode * mine, SplitNode * theirs,
+                           const int depth, const uint64_t prefix, Gone& gone);
+    template <class Fn>
+    static void diff_slots(Node * mine, Node * theirs, const int depth,
+                           const uint64_t path, Fn& fn);
+    /* Run `fn(i)` for the root slots `i` in `slots` on up to `threads`
+     * threads */
+    static void for_each_root_slot(const std::vector<int>& slots,
+                                   const unsigned threads,
+                                   const std::function<void(int)>& fn);
+
+    /* A unit of work for the parallel scans: the child in a slot at
+     * `depth` whose path is `path`, and its key count */
+    struct ScanTask {
+        Node * child;
+        int depth;
+        uint64_t path;
+        size_t weight;
     };
+    /* The trie as subtrees of about `1/(8 * threads)` of its keys (or
+     * single leaves), in trie order */
+    std::vector<ScanTask> scan_tasks(const unsigned threads);
+    static void split_task(const ScanTask& task, const size_t target,
+                           std::vector<ScanTask>& out);
+    /* Run `fn(i)` for every task on up to `threads` work-stealing threads */
+    static void run_stealing(const std::vector<ScanTask>& tasks,
+                             const unsigned threads,
+                             const std::function<void(size_t)>& fn);
+
+    /* Add the subtree below `node` to `stats`, returning its key count */
+    size_t inspect_node(SplitNode * node, const int depth, Stats& stats);
+
+    /* Take references on `other`'s root-level nodes, for copying */
+    void share_from(ReliableHAMT& other);
+
+    /* Change log ring, change `s` is `_log[s % _log.size()]`. Records own
+     * their keys, which may outlive the caller's or the trie's copy. */
+    struct LogRecord {
+        HashType hash;
+        DeltaOp op;
+        typename KeyStore<Key>::owned_type key;
+        std::optional<T> value;
+    };
+    std::vector<LogRecord> _log;
+    size_t _log_count = 0;
+    uint64_t _log_seq = 0;
+    void log_change(const hash_type&, const DeltaOp, const key_type&,
+                    const mapped_type *);
+
+    /* Bytes of the stored keys, for key types that refer to them (see
+     * KeyStore); shared with copies and snapshots, null for other keys */
+    std::shared_ptr<KeyArena> _keys =
+            KeyStore<Key>::arena ? std::make_shared<KeyArena>() : nullptr;
+
+    /* Cache mode, see `set_capacity`. `_hand` is the next leaf-level slot
+     * the CLOCK hand visits, as its subhash at each level (the levels the
+     * root table replaces included); an entry of `nchldrn` at the leaf level
+     * means the rest of that child array has been visited.
+     */
+    size_t _capacity = 0;
+    std::array<uint8_t, maxdepth> _hand = {};
+    struct Victim {
+        HashType hash;
+        Key key;
+    };
+    /* Move the hand through the slots at `depth` of `node` (null for the
+     * levels above the root table's entries), starting from its position
+     * if `at_hand`, and collect unmarked entries into `out`. Returns true
+     * once `out` holds `want`, false at the end of the child array.
+     */
+    bool clock_sweep(SplitNode * node, const int depth, const uint64_t prefix,
+                     const bool at_hand, const size_t want,
+                     std::vector<Victim>& out);
+    /* Evict down to the capacity, sparing the key `keep` (if any) */
+    void evict(const hash_type& keep_hash, const key_type * keep);
 
     SplitNode _root;
     hasher hasher_function;
+    verify _verify = verify::always;
+    unsigned _verify_period = 64;
 
-    friend class Injector<Key, T, FT, HashType, Hash, Pred, Alloc>;
+    friend class Injector<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>;
+    friend class FrozenReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc,
+                                    Protect>;
+};
+
+/* A point-in-time view of a ReliableHAMT, from `ReliableHAMT::snapshot()`.
+ *
+ * The snapshot holds its own copy of the root (and root table) and a
+ * reference on every node below it. Writes to the trie never modify a node
+ * with more than one reference: they copy it, and the nodes above it, into
+ * the trie's own version first, so the snapshot's contents never change and
+ * its readers need no locks. Reads vote on and repair shared nodes just as
+ * reads of the trie do. A node is freed once neither the trie nor any
+ * snapshot references it. Returned pointers are valid while the snapshot is.
+ */
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+class ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::Snapshot {
+public:
+    bool   empty() const { return _view.empty(); }
+    size_t size() const { return _view.size(); }
+    const mapped_type * read(const key_type& key) { return _view.read(key); }
+    size_t scrub() { return _view.scrub(); }
+
+    /* A mutable trie starting from the snapshot, again sharing its nodes */
+    ReliableHAMT thaw() const { return _view; }
+
+private:
+    friend class ReliableHAMT;
+    explicit Snapshot(const ReliableHAMT& trie) : _view(trie) {}
+
+    ReliableHAMT _view;
 };
 
 /**** Leaf Node Implementation ****/
-template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred, class Alloc>
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
 const T *
-ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc>::
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
 LeafNode::safe_traverse(const HashType& hash, const Key& key, omtr val,
                         const optype op, const int depth,
-                        Node * root, size_t * ccount)
+                        ReliableHAMT * trie, size_t * ccount)
 {
     /* Verify this node is correct by comparing the provided hash with the
      * agreed upon value after voting. If the hash is incorrect, we are not
      * at the correct node, so we must repair the structure.
      */
     (void)depth;
-    hashvoter(hashes);
+    vote_hashes();
     if (hash != hashes[0]) {
         throw("Uh-oh, an unrepairable error was found in leaf node");
     }
-    return apply_op(key, val, ccount, op);
+    return apply_op(key, val, ccount, op, trie);
 }
 
-template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred, class Alloc>
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
 const T *
-ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc>::
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
 LeafNode::fast_traverse(const HashType& hash, const Key& key, omtr val,
                         const optype op, const int depth,
-                        Node * root, size_t * ccount)
+                        ReliableHAMT * trie, size_t * ccount)
 {
     (void)depth;
-    try {
-        hashvoter(hashes);
+    if (check_hash(hash, trie)) {
+        return apply_op(key, val, ccount, op, trie);
     }
-    catch (const std::runtime_error& e) {
-        return root->safe_traverse(hash, key, val, op, 0, root, ccount);
+
+    return trie->recover(hash, key, val, op, ccount);
+}
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+bool
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+LeafNode::check_hash(const HashType& hash, const ReliableHAMT * trie)
+{
+    /* The cheap checks can only accept; anything suspicious (and every
+     * `period`th sampled access) falls through to a full vote.
+     */
+    static thread_local unsigned tick = 0;
+    switch (trie->_verify) {
+        case RHAMT::verify::replica:
+            if (hash == hashes[0] && hashes[0] == hashes[ft-1])
+                return true;
+            break;
+        case RHAMT::verify::sampled:
+            if (hash == hashes[0] && 0 != ++tick % trie->_verify_period)
+                return true;
+            break;
+        case RHAMT::verify::always:
+            break;
     }
-    if (hash != hashes[0]) {
-        return root->safe_traverse(hash, key, val, op, 0, root, ccount);
+
+    try {
+        vote_hashes();
     }
-    else {
-        return apply_op(key, val, ccount, op);
+    catch (const std::runtime_error& e) {
+        return false;
     }
+    return hash == hashes[0];
 }
 
-template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred, class Alloc>
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
 const T *
-ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc>::
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
 LeafNode::apply_op(const Key &key, omtr val,
-                   size_t * ccount, const optype op)
+                   size_t * ccount, const optype op, ReliableHAMT * trie)
 {
     const T * retval = nullptr;
+    *ccount = 0;
     switch (op) {
         case RHAMT::Node::optype::insert:
-            retval = this->insert(key, val);
+            retval = this->insert(key, val, ccount, trie);
             break;
         case RHAMT::Node::optype::remove:
             retval = reinterpret_cast<const T*>(this->remove(key, ccount));
@@ -248,60 +1179,65 @@ LeafNode::apply_op(const Key &key, omtr val,
     return retval;
 }
 
-template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred, class Alloc>
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
 const T *
-ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc>::
-LeafNode::insert(const Key& key, omtr val)
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+LeafNode::insert(const Key& key, omtr val, size_t *childcount,
+                 ReliableHAMT * trie)
 {
     /* Normally, we don't expect multiple keys to map to the same hash, since
      * most key types have a strong hash function available. If a collision
      * does occur, we must search through the list to find the matching key.
+     * `childcount` is set to 1 if a new key was added, 0 on overwrite.
      */
     if (!val.has_value())
         throw "wtf why does omtr not have value in insert?!";
 
     const T& tval = val.value().get();
 
-    for (auto & it : data) {
-        if (key_eq(it.first, key)) {
-            it.second = tval;
-            return &it.second;
-        }
-    }
+    /* An entry is never written once readers can see it, so an overwrite
+     * replaces the whole entry (keeping its stored key) */
+    auto link = data.find(key, key_eq);
+    typename Chain::Entry * e = link->load(std::memory_order_relaxed);
+    if (nullptr != e)
+        return &data.emplace(link, e->kv.first, tval)->kv.second;
 
     /* If no match was found, insert the new key-value pair */
-    data.push_back(std::make_pair(key, tval));
-    return &data.back().second;
+    e = data.emplace(link, KeyStore<Key>::intern(trie->_keys.get(), key),
+                     tval);
+    *childcount = 1;
+    return &e->kv.second;
 }
 
 
-template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred, class Alloc>
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
 int
-ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc>::
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
 LeafNode::remove(const Key& key, size_t *childcount)
 {
-    /* Search for matching key-value pair, removing it if found. Update the
-     * parent's `childcount` with the size of the data list.  Return 1 if
-     * a value was successfully removed, otherwise 0.
+    /* Search for matching key-value pair, removing it if found. Return 1 if
+     * a value was successfully removed, otherwise 0, and report the same
+     * through `childcount` for the parents' key counts.
      */
     int rv = 0;
-    for (auto & it : data) {
-        if (key_eq(it.first, key)) {
-            data.remove(it);
-            rv = 1;
-            break;
-        }
+    auto link = data.find(key, key_eq);
+    if (nullptr != link->load(std::memory_order_relaxed)) {
+        data.erase(link);
+        rv = 1;
     }
 
     if (childcount)
-        *childcount = data.size();
+        *childcount = rv;
     return rv;
 }
 
 
-template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred, class Alloc>
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
 const T *
-ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc>::
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
 LeafNode::read(const Key& key)
 {
     /* Read a key-value pair from the data list, returning a pointer to the
@@ -316,87 +1252,137 @@ LeafNode::read(const Key& key)
 }
 
 
-template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred, class Alloc>
-ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc>::
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
 LeafNode::~LeafNode() { }
 
 
 /**** Split Node Implementation ****/
 
 
-template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred, class Alloc>
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
 const T *
-ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc>::
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
 SplitNode::safe_traverse(const HashType & hash, const Key & key, omtr val,
-                         const optype op, const int depth, Node * root,
-                         size_t * ccount)
+                         const optype op, const int depth,
+                         ReliableHAMT * trie, size_t * ccount)
 {
+    /* Writes copy any node they pass through that a snapshot shares */
     int child_idx = getChild(hash, depth);
-    childvoter(children[child_idx]);
-    if (nullptr == children[child_idx][0]) {
-        RHAMT::Node * newnode;
-        if (depth == (maxdepth-1))
-            { newnode = new RHAMT::LeafNode(hash); }
-        else
-            { newnode = new RHAMT::SplitNode(); }
-        for (int j = 0; j < ft; ++j)
-            children[child_idx][j] = newnode;
+    RHAMT::Node * child = (RHAMT::Node::optype::read == op)
+                        ? children.vote(child_idx)
+                        : own_slot(children, child_idx);
+    const T * rv;
+    if (InlineEntry::enabled && depth == (maxdepth-1) &&
+            (nullptr == child || InlineEntry::is(child))) {
+        rv = inline_safe(child_idx, child, hash, key, val, op, trie, ccount);
     }
-    const T * rv = children[child_idx][0]->safe_traverse(
-                                    hash, key, val, op, depth+1, root, ccount);
-
-    uintptr_t crv = reinterpret_cast<uintptr_t>(rv);
-    switch (op) {
-        case RHAMT::Node::optype::insert:
-            _count += crv;
-            break;
-        case RHAMT::Node::optype::remove:
-            _count -= crv;
-            *ccount = _count;
-            break;
-        case RHAMT::Node::optype::read:
-            break;
-        default:
-            throw "WTF???";
+    else {
+        if (InlineEntry::is(child))
+            throw std::runtime_error("inline entry above the leaf level");
+        if (nullptr == child && RHAMT::Node::optype::insert != op) {
+            // The key is not in the trie; nothing to read or remove
+            *ccount = 0;
+            return nullptr;
+        }
+        if (nullptr == child) {
+            if (depth == (maxdepth-1))
+                { child = new RHAMT::LeafNode(hash); }
+            else
+                { child = new RHAMT::SplitNode(); }
+            children.set(child_idx, child);
+        }
+        rv = child->safe_traverse(hash, key, val, op, depth+1, trie, ccount);
     }
-
+    if (depth == (maxdepth-1) && trie->_capacity)
+        note_use(child_idx, op, nullptr != rv, *ccount);
+    update_count(op, *ccount);
+    if (RHAMT::Node::optype::remove == op)
+        prune(child_idx);
     return rv;
 }
 
 
-template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred, class Alloc>
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
 const T *
-ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc>::
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
 SplitNode::fast_traverse(const HashType & hash, const Key & key, omtr val,
-                         const optype op, const int depth, Node * root,
-                         size_t * ccount)
+                         const optype op, const int depth,
+                         ReliableHAMT * trie, size_t * ccount)
 {
     const T * retval;
-    static struct sigaction sa = {sigsegv_handler, (unsigned)NULL, 0,
-                                  0, (unsigned)NULL};
-    sa.sa_flags = SA_NODEFER | SA_RESETHAND;
     if (depth == 0) {
-        // Turn On Signal Handler
-        if (0 != sigaction(SIGSEGV, &sa, NULL)) {
-            perror("sigaction");
-            exit(1);
-        }
+        static const bool installed = install_sigsegv_handler();
+        (void)installed;
 
         if (setjmp(env) > 0) {
-            return root->safe_traverse(hash, key, val, op, 0, root, ccount);
+            const T * rv = trie->_root.safe_traverse(
+                                    hash, key, val, op, 0, trie, ccount);
+            if (RHAMT::Node::optype::read != op)
+                trie->recount_path(hash);
+            return rv;
+        }
+        env_armed = 1;
+    }
+
+    /* An empty slot is either a miss or a damaged pointer. The root is not
+     * reached through a pointer, so voting its slot settles it; deeper down
+     * we may be on the wrong path, so the answer comes from a voted descent
+     * from the root instead, which stops at the first empty voted slot.
+     * Neither takes a fault or allocates unless we are inserting.
+     */
+    int child_idx = getChild(hash, depth);
+    RHAMT::Node * child = children.get(child_idx);
+    if (nullptr == child && depth == 0 && RHAMT::Node::optype::insert != op) {
+        try {
+            child = children.vote(child_idx);
+        }
+        catch (const std::runtime_error& e) { }
+        if (nullptr == child) {
+            env_armed = 0;
+            *ccount = 0;
+            return nullptr;
         }
     }
 
-    retval = children[getChild(hash, depth)][0]->fast_traverse(
-                                    hash, key, val, op, depth+1, root, ccount);
-    signal(SIGSEGV, SIG_DFL);
+    /* Shared nodes are only copied on the safe path, where the pointer
+     * being copied has been voted on.
+     */
+    if (nullptr == child)
+        retval = trie->recover(hash, key, val, op, ccount);
+    else if (InlineEntry::is(child))
+        retval = inline_fast(child_idx, hash, key, val, op, depth, trie, ccount);
+    else if (RHAMT::Node::optype::read != op && child->shared())
+        retval = trie->recover(hash, key, val, op, ccount);
+    else
+        retval = child->fast_traverse(
+                                    hash, key, val, op, depth+1, trie, ccount);
+    if (depth == (maxdepth-1) && trie->_capacity)
+        note_use(child_idx, op, nullptr != retval, *ccount);
+    update_count(op, *ccount);
+    /* The change is made, and pruning may retire nodes and run the
+     * reclaimer, which must never be cut short by a jump back to the root:
+     * it would leave the limbo list half compacted (or the orphan lock
+     * held) and the safe path redoing a half-unlinked remove. So the guard
+     * is dropped first; pruning only follows voted pointers.
+     */
+    if (RHAMT::Node::optype::remove == op) {
+        env_armed = 0;
+        prune(child_idx);
+    }
+    if (depth == 0)
+        env_armed = 0;
     return retval;
 }
 
 
-template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred, class Alloc>
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
 inline int
-ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc>::
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
 SplitNode::getChild(const HashType& hash, const int depth)
 {
     HashType shash = ReliableHAMT::subhash(hash, depth);
@@ -404,75 +1390,2493 @@ SplitNode::getChild(const HashType& hash, const int depth)
 }
 
 
-template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred, class Alloc>
-ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc>::
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+const T *
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+SplitNode::inline_fast(const int idx, const HashType& hash, const Key& key,
+                       omtr val, const optype op, const int depth,
+                       ReliableHAMT * trie, size_t * ccount)
+{
+    /* A tagged word anywhere but the leaf level, or an entry for another
+     * key, means we may have been sent down the wrong path.
+     */
+    if constexpr (InlineEntry::enabled) {
+        if (depth == (maxdepth-1)) {
+            Node * entry = children.get(idx);
+            if (RHAMT::verify::always == trie->_verify) {
+                try {
+                    entry = children.vote(idx);
+                }
+                catch (const std::runtime_error& e) {
+                    entry = nullptr;
+                }
+            }
+            if (InlineEntry::is(entry) &&
+                    key_equal()(InlineEntry::key(entry), key))
+                return inline_apply(idx, key, val, op, ccount);
+        }
+    }
+    return trie->recover(hash, key, val, op, ccount);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+const T *
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+SplitNode::inline_safe(const int idx, Node * entry, const HashType& hash,
+                       const Key& key, omtr val, const optype op,
+                       ReliableHAMT * trie, size_t * ccount)
+{
+    *ccount = 0;
+    if constexpr (InlineEntry::enabled) {
+        if (nullptr != entry && key_equal()(InlineEntry::key(entry), key))
+            return inline_apply(idx, key, val, op, ccount);
+        if (RHAMT::Node::optype::insert != op)
+            return nullptr;
+        if (nullptr == entry) {
+            children.set(idx, InlineEntry::pack(key, val.value().get()));
+            *ccount = 1;
+            return InlineEntry::value_ptr(children.raw(idx, 0));
+        }
+
+        /* Two keys share the full hash, so move both into a real leaf */
+        RHAMT::LeafNode * leaf = new RHAMT::LeafNode(hash);
+        leaf->data.emplace_back(InlineEntry::key(entry),
+                                InlineEntry::value(entry));
+        children.set(idx, leaf);
+        return leaf->apply_op(key, val, ccount, op, trie);
+    }
+    return nullptr;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+const T *
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+SplitNode::inline_apply(const int idx, const Key& key, omtr val,
+                        const optype op, size_t * ccount)
+{
+    /* The slot holds `key`. Pointers handed out refer to the primary copy,
+     * which every write keeps up to date.
+     */
+    *ccount = 0;
+    if constexpr (InlineEntry::enabled) {
+        switch (op) {
+            case RHAMT::Node::optype::insert:
+                children.set(idx, InlineEntry::pack(key, val.value().get()));
+                return InlineEntry::value_ptr(children.raw(idx, 0));
+            case RHAMT::Node::optype::remove:
+                children.set(idx, nullptr);
+                *ccount = 1;
+                return reinterpret_cast<const T*>(1);
+            case RHAMT::Node::optype::read:
+                return InlineEntry::value_ptr(children.raw(idx, 0));
+        }
+    }
+    return nullptr;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+SplitNode::prune(const int child_idx)
+{
+    prune_slot(children, child_idx);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+prune_slot(Slots& children, const int child_idx)
+{
+    /* Vote before trusting the pointer, then clear every copy before the
+     * child is released, so that no stale majority can later vote a freed
+     * node back into the trie. The node itself is only freed by the
+     * reclaimer once the operation has finished with it, and only if no
+     * snapshot still shares it.
+     */
+    Node * child;
+    try {
+        child = children.vote(child_idx);
+    }
+    catch (const std::runtime_error& e) {
+        return;     // leave it to the next safe traversal to repair
+    }
+    if (nullptr == child || InlineEntry::is(child) || !child->is_empty())
+        return;
+
+    children.set(child_idx, nullptr);
+    unlink(child);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+inline void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+acquire(Node * node)
+{
+    node->_refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+inline void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+unlink(Node * node)
+{
+    if (1 == node->_refs.fetch_sub(1, std::memory_order_acq_rel))
+        EpochReclaimer::instance().retire(node, &Node::destroy);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+inline void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+drop(Node * node)
+{
+    /* The parent is unreachable, so a child it alone referenced is too */
+    if (1 == node->_refs.fetch_sub(1, std::memory_order_acq_rel))
+        delete node;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+auto
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+own_slot(Slots& slots, const int idx) -> Node *
+{
+    Node * child = slots.vote(idx);
+    if (nullptr == child || InlineEntry::is(child) || !child->shared())
+        return child;
+    Node * copy = child->clone();
+    slots.set(idx, copy);
+    unlink(child);
+    return copy;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+bool
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+SplitNode::is_empty()
+{
+    /* `_count` is not replicated, so confirm with the (voted) child slots
+     * before declaring the subtree empty.
+     */
+    if (0 != _count)
+        return false;
+    for (int i = 0; i < nchldrn; ++i) {
+        try {
+            if (nullptr != children.vote(i))
+                return false;
+        }
+        catch (const std::runtime_error& e) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+size_t
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+SplitNode::scrub()
+{
+    size_t checked = 1;
+    for (int i = 0; i < nchldrn; ++i) {
+        Node * child = children.vote(i);
+        if (nullptr != child && !InlineEntry::is(child))
+            checked += child->scrub();
+    }
+    return checked;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
 SplitNode::~SplitNode()
 {
-    for (auto &child : children) {
-        //childvoter(child);    // TODO: this causes a massive slowdown
-        delete child[0];
+    for (int i = 0; i < nchldrn; ++i) {
+        Node * child = children.get(i);
+        if (nullptr != child && !InlineEntry::is(child))
+            __builtin_prefetch(&child->_refs, 1);
+    }
+    for (int i = 0; i < nchldrn; ++i) {
+        //children.vote(i);    // TODO: this causes a massive slowdown
+        Node * child = children.get(i);
+        if (nullptr != child && !InlineEntry::is(child))
+            drop(child);
+    }
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+SplitNode::copy_from(SplitNode& src)
+{
+    /* Pointers are voted before they are shared, so a reference is never
+     * taken on behalf of a damaged copy. The children are usually cold, so
+     * all of their counts are fetched before any is incremented.
+     */
+    std::array<Node *, nchldrn> shared;
+    for (int i = 0; i < nchldrn; ++i) {
+        Node * child = src.children.vote(i);
+        children.set(i, child);
+        shared[i] = (nullptr == child || InlineEntry::is(child)) ? nullptr
+                                                                : child;
+        if (nullptr != shared[i])
+            __builtin_prefetch(&shared[i]->_refs, 1);
     }
+    for (Node * child : shared)
+        if (nullptr != child)
+            acquire(child);
+    _count = src._count;
+    _referenced.store(src._referenced.load(std::memory_order_relaxed),
+                      std::memory_order_relaxed);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+auto
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+SplitNode::clone() -> Node *
+{
+    std::unique_ptr<SplitNode> copy(new SplitNode());
+    copy->copy_from(*this);
+    return copy.release();
 }
 
 
 /**** ReliableHAMT Implementation ****/
 
-template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred, class Alloc>
-const T *
-ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc>::
-insert(const Key& key, const T& tval)
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+ReliableHAMT(const ReliableHAMT& other)
+    : _table_bits(other._table_bits), _filter(other._filter),
+      _filter_mask(other._filter_mask), _keys(other._keys),
+      _capacity(other._capacity), hasher_function(other.hasher_function),
+      _verify(other._verify), _verify_period(other._verify_period)
 {
-    size_t hash = hasher_function(key);
-    size_t cc;
-    const mapped_type * rv;
-    auto val = std::optional<std::reference_wrapper<const T>>(
-            std::reference_wrapper<const T>(tval));
-    rv = _root.fast_traverse(
-            hash, key, val, Node::optype::insert, 0, &_root, &cc);
-    return rv;
+    // Voting may repair `other`'s slots but leaves its contents unchanged
+    share_from(const_cast<ReliableHAMT&>(other));
 }
 
 
-template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred, class Alloc>
-int
-ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc>::
-remove(const Key& key)
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+auto
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+operator=(const ReliableHAMT& other) -> ReliableHAMT&
 {
-    HashType hash = hasher_function(key);
-    size_t cc;
-    auto val = std::optional<std::reference_wrapper<const T>>();
-    return reinterpret_cast<uintptr_t>(_root.fast_traverse(
-                hash, key, val, Node::optype::remove, 0, &_root, &cc));
+    if (this == &other)
+        return *this;
+    ReliableHAMT copy(other);
+    std::swap(_root.children, copy._root.children);
+    std::swap(_root._count, copy._root._count);
+    std::swap(_table_bits, copy._table_bits);
+    _table.swap(copy._table);
+    _table_totals.swap(copy._table_totals);
+    _filter.swap(copy._filter);
+    std::swap(_filter_mask, copy._filter_mask);
+    _keys = other._keys;
+    _capacity = other._capacity;
+    hasher_function = other.hasher_function;
+    _verify = other._verify;
+    _verify_period = other._verify_period;
+    return *this;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+share_from(ReliableHAMT& other)
+{
+    EpochReclaimer::Guard guard;
+    _root.copy_from(other._root);
+    _table.resize(other._table.size());
+    for (size_t b = 0; b < _table.size(); ++b) {
+        for (int slot = 0; slot < nchldrn; ++slot) {
+            Node * child = other._table[b].vote(slot);
+            _table[b].set(slot, child);
+            if (nullptr != child)
+                acquire(child);
+        }
+    }
+    _table_totals = other._table_totals;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+auto
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+snapshot() -> Snapshot
+{
+    return Snapshot(*this);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+~ReliableHAMT()
+{
+    for (auto &block : _table) {
+        for (int slot = 0; slot < nchldrn; ++slot) {
+            Node * child = block.get(slot);
+            if (nullptr != child)
+                drop(child);
+        }
+    }
 }
 
 
-template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred, class Alloc>
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
 const T *
-ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc>::
-read(const Key& key)
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+recover(const HashType& hash, const Key& key, typename Node::omtr val,
+        const typename Node::optype op, size_t * ccount)
 {
-    HashType hash = hasher_function(key);
-    size_t cc;
-    const mapped_type * rv;
+    /* Repair from the root. The safe path updates the counts along the voted
+     * path itself, so report no change to the (possibly wrong) fast path
+     * frames the result is returned through.
+     */
+    env_armed = 0;
+    const T * rv = root_safe(hash, key, val, op, ccount);
+    *ccount = 0;
+    return rv;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+const T *
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+root_fast(const HashType& hash, const Key& key, typename Node::omtr val,
+          const typename Node::optype op, size_t * ccount)
+{
+    if (0 == _table_bits)
+        return _root.fast_traverse(hash, key, val, op, 0, this, ccount);
+
+    /* As SplitNode::fast_traverse at depth 0, with the table as the node */
+    static const bool installed = install_sigsegv_handler();
+    (void)installed;
+    if (setjmp(env) > 0) {
+        const T * rv = root_safe(hash, key, val, op, ccount);
+        if (Node::optype::read != op)
+            recount_path(hash);
+        return rv;
+    }
+    env_armed = 1;
+
+    int slot;
+    Slots& block = table_block(hash, slot);
+    Node * child = block.get(slot);
+    if (nullptr == child && Node::optype::insert != op) {
+        try {
+            child = block.vote(slot);
+        }
+        catch (const std::runtime_error& e) { }
+        if (nullptr == child) {
+            env_armed = 0;
+            *ccount = 0;
+            return nullptr;
+        }
+    }
+
+    const T * retval;
+    if (nullptr == child || InlineEntry::is(child) ||
+            (Node::optype::read != op && child->shared()))
+        retval = recover(hash, key, val, op, ccount);
+    else
+        retval = child->fast_traverse(hash, key, val, op,
+                        _table_bits / nlog2chldrn, this, ccount);
+    _root.update_count(op, *ccount);
+    table_tally(hash, op, *ccount);
+    env_armed = 0;      // before pruning, as in SplitNode::fast_traverse
+    if (Node::optype::remove == op)
+        prune_slot(block, slot);
+    return retval;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+const T *
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+root_safe(const HashType& hash, const Key& key, typename Node::omtr val,
+          const typename Node::optype op, size_t * ccount)
+{
+    if (0 == _table_bits)
+        return _root.safe_traverse(hash, key, val, op, 0, this, ccount);
+    const T * rv = table_descend(hash, key, val, op, ccount);
+    _root.update_count(op, *ccount);
+    return rv;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+inline auto
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+table_block(const HashType& hash, int& slot) -> Slots&
+{
+    const size_t j = hash & ((size_t(1) << _table_bits) - 1);
+    slot = j >> (_table_bits - nlog2chldrn);
+    return _table[j & (_table.size() - 1)];
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+const T *
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+table_descend(const HashType& hash, const Key& key, typename Node::omtr val,
+              const typename Node::optype op, size_t * ccount)
+{
+    int slot;
+    Slots& block = table_block(hash, slot);
+    Node * child = (Node::optype::read == op) ? block.vote(slot)
+                                              : own_slot(block, slot);
+    if (InlineEntry::is(child))
+        throw std::runtime_error("inline entry in the root table");
+    if (nullptr == child) {
+        *ccount = 0;
+        if (Node::optype::insert != op)
+            return nullptr;
+        child = new SplitNode();
+        block.set(slot, child);
+    }
+    const T * rv = child->safe_traverse(hash, key, val, op,
+                            _table_bits / nlog2chldrn, this, ccount);
+    table_tally(hash, op, *ccount);
+    if (Node::optype::remove == op)
+        prune_slot(block, slot);
+    return rv;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+table_tally(const HashType& hash, const typename Node::optype op,
+            const size_t delta)
+{
+    if (0 == delta || Node::optype::read == op)
+        return;
+    const int levels = _table_bits / nlog2chldrn;
+    const size_t m = table_order(hash);
+    for (int d = 1; d < levels; ++d) {
+        size_t& total = _table_totals[table_level(d) +
+                                      (m >> (nlog2chldrn * (levels - d)))];
+        if (Node::optype::insert == op)
+            total += delta;
+        else
+            total -= delta;
+    }
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+table_retally()
+{
+    const int levels = _table_bits / nlog2chldrn;
+    auto tally = [&](const bool recount) {
+        _table_totals.assign(table_level(levels), 0);
+        size_t total = 0;
+        for (size_t j = 0; j < (size_t(1) << _table_bits); ++j) {
+            int slot;
+            Node * child = table_block(static_cast<HashType>(j), slot).vote(slot);
+            if (nullptr == child)
+                continue;
+            if (InlineEntry::is(child))
+                throw std::runtime_error("inline entry in the root table");
+            const size_t n = recount
+                ? recount_node(static_cast<SplitNode *>(child), levels)
+                : count_in_slot(child, levels - 1);
+            const size_t m = table_order(static_cast<HashType>(j));
+            for (int d = 1; d < levels; ++d)
+                _table_totals[table_level(d) +
+                              (m >> (nlog2chldrn * (levels - d)))] += n;
+            total += n;
+        }
+        return total;
+    };
+    const size_t total = tally(false);
+    if (total != _root._count)
+        _root._count = tally(true);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+set_root_bits(const unsigned bits)
+{
+    if (bits != 0 && (bits % nlog2chldrn != 0 || bits < 2 * nlog2chldrn ||
+                      (int)(bits / nlog2chldrn) >= maxdepth - 1))
+        throw std::invalid_argument("unsupported root table width");
+    EpochReclaimer::Guard guard;
+
+    /* Hang the table's subtrees back under the root... */
+    const int levels = _table_bits / nlog2chldrn;
+    for (size_t b = 0; b < _table.size(); ++b) {
+        for (int slot = 0; slot < nchldrn; ++slot) {
+            Node * sub = _table[b].vote(slot);
+            if (nullptr == sub)
+                continue;
+            const size_t j = b | (size_t(slot) << (_table_bits - nlog2chldrn));
+            SplitNode * node = &_root;
+            for (int d = 0; d < levels - 1; ++d) {
+                const int idx = subhash(j, d);
+                Node * next = node->children.vote(idx);
+                if (nullptr == next) {
+                    next = new SplitNode();
+                    node->children.set(idx, next);
+                }
+                node = static_cast<SplitNode *>(next);
+            }
+            node->children.set(subhash(j, levels - 1), sub);
+        }
+    }
+    /* ...restore the counts of the split nodes just recreated... */
+    std::function<size_t(SplitNode *, int)> recount =
+            [&](SplitNode * node, int depth) -> size_t {
+        if (depth == levels)
+            return node->getCount();
+        size_t n = 0;
+        for (int i = 0; i < nchldrn; ++i) {
+            Node * child = node->children.vote(i);
+            if (nullptr != child)
+                n += recount(static_cast<SplitNode *>(child), depth + 1);
+        }
+        if (depth > 0)
+            node->_count = n;
+        return n;
+    };
+    if (levels > 0)
+        recount(&_root, 0);
+    _table.clear();
+    _table_totals.clear();
+    _table_bits = 0;
+    if (0 == bits)
+        return;
+
+    /* ...then lift the subtrees at the new table depth into the table */
+    const int stop = bits / nlog2chldrn;
+    std::vector<Slots> table(size_t(1) << (bits - nlog2chldrn));
+    for (size_t j = 0; j < (size_t(1) << bits); ++j) {
+        Node * node = &_root;
+        for (int d = 0; d < stop && nullptr != node; ++d)
+            node = static_cast<SplitNode *>(node)->children.vote(subhash(j, d));
+        if (nullptr != node) {
+            acquire(node);
+            table[j & (table.size() - 1)].set(j >> (bits - nlog2chldrn), node);
+        }
+    }
+    /* The table holds its own references now, so the levels above can go */
+    for (int i = 0; i < nchldrn; ++i) {
+        Node * child = _root.children.vote(i);
+        if (nullptr == child)
+            continue;
+        _root.children.set(i, nullptr);
+        unlink(child);
+    }
+    _table.swap(table);
+    _table_bits = bits;
+    table_retally();
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+set_capacity(const size_t max_keys)
+{
+    _capacity = max_keys;
+    if (_capacity && _root._count > _capacity)
+        evict(0, nullptr);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+bool
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+clock_sweep(SplitNode * node, const int depth, const uint64_t prefix,
+            const bool at_hand, const size_t want, std::vector<Victim>& out)
+{
+    /* `_hand` is rewritten on the way down, so that wherever the sweep
+     * stops, the next one resumes from the slot after the last visited.
+     */
+    const int start = at_hand ? _hand[depth] : 0;
+    for (int i = start; i < nchldrn; ++i) {
+        const bool on_hand = at_hand && i == start;
+        const uint64_t path = prefix | (uint64_t(i) << (nlog2chldrn * depth));
+        _hand[depth] = i;
+
+        Node * child;
+        if (nullptr != node) {
+            child = node->children.vote(i);
+        }
+        else if (depth < (int)(_table_bits / nlog2chldrn) - 1) {
+            if (clock_sweep(nullptr, depth + 1, path, on_hand, want, out))
+                return true;
+            continue;
+        }
+        else {
+            int slot;
+            child = table_block(static_cast<HashType>(path), slot).vote(slot);
+        }
+        if (nullptr == child)
+            continue;
+
+        if (depth < maxdepth - 1) {
+            if (InlineEntry::is(child))
+                throw std::runtime_error("inline entry above the leaf level");
+            if (clock_sweep(static_cast<SplitNode *>(child), depth + 1, path,
+                            on_hand, want, out))
+                return true;
+            continue;
+        }
+
+        /* A leaf-level slot: spare it once if it was read since last time */
+        _hand[depth] = i + 1;
+        const uint32_t bit = uint32_t(1) << i;
+        if (node->_referenced.load(std::memory_order_relaxed) & bit) {
+            node->_referenced.fetch_and(~bit, std::memory_order_relaxed);
+            continue;
+        }
+        if (InlineEntry::is(child)) {
+            if constexpr (InlineEntry::enabled)
+                out.push_back({static_cast<HashType>(path),
+                               InlineEntry::key(child)});
+        }
+        else {
+            LeafNode * leaf = static_cast<LeafNode *>(child);
+            leaf->scrub();
+            for (auto &kv : leaf->data)
+                out.push_back({leaf->hashes[0], kv.first});
+        }
+        if (out.size() >= want)
+            return true;
+    }
+    return false;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+evict(const HashType& keep_hash, const Key * keep)
+{
+    /* Each round sweeps for as many victims as there are keys too many.
+     * Three laps of the hand are enough to find one if any key may go: the
+     * first may start at the end of the trie and the second may only clear
+     * marks. A round may find nothing but `keep`, after which the hand has
+     * passed it; after three rounds without a removal there is nothing
+     * else to evict.
+     */
+    EpochReclaimer::Guard guard;
+    std::vector<Victim> victims;
+    int stalls = 0;
+    while (_root._count > _capacity && stalls < 3) {
+        const size_t want = _root._count - _capacity;
+        victims.clear();
+        for (int lap = 0; lap < 3 && victims.size() < want; ++lap) {
+            if (!clock_sweep(0 == _table_bits ? &_root : nullptr, 0, 0, true,
+                             want, victims))
+                _hand.fill(0);
+        }
+        size_t removed = 0;
+        for (auto &v : victims) {
+            if (nullptr != keep && v.hash == keep_hash &&
+                    key_equal()(v.key, *keep))
+                continue;
+            removed += remove_hashed(v.hash, v.key);
+        }
+        stalls = removed ? 0 : stalls + 1;
+    }
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+template <class InputIt>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+build(InputIt first, InputIt last, unsigned threads)
+{
+    EpochReclaimer::Guard guard;
+    using Entry = std::pair<HashType, InputIt>;
+    const size_t n = std::distance(first, last);
+    threads = std::max(1u, std::min<unsigned>(threads, nchldrn));
+
+    /* Partition: each thread hashes one chunk of the input into its own set
+     * of buckets, so that bucket (t, j) holds the chunk-t entries bound for
+     * root child j, still in input order.
+     */
+    std::vector<std::array<std::vector<Entry>, nchldrn>> buckets(threads);
+    std::vector<InputIt> bounds(threads + 1, first);
+    for (unsigned t = 1; t <= threads; ++t)
+        bounds[t] = std::next(bounds[t-1],
+                              n / threads + (t - 1 < n % threads ? 1 : 0));
+
+    auto run = [threads](auto fn) {
+        if (threads == 1) {
+            fn(0u);
+            return;
+        }
+        std::vector<std::thread> pool;
+        for (unsigned t = 0; t < threads; ++t)
+            pool.emplace_back(fn, t);
+        for (auto &th : pool)
+            th.join();
+    };
+
+    run([&](unsigned t) {
+        for (InputIt it = bounds[t]; it != bounds[t+1]; ++it) {
+            HashType hash = hash_of((*it).first);
+            buckets[t][subhash(hash, 0)].emplace_back(hash, it);
+        }
+    });
+
+    /* With a root table, each worker owns the table blocks of one root-level
+     * subhash and inserts below them directly.
+     */
+    if (0 != _table_bits) {
+        std::atomic<size_t> total(0);
+        std::atomic<int> next(0);
+        run([&](unsigned) {
+            size_t added = 0;
+            for (int j = next++; j < nchldrn; j = next++) {
+                for (unsigned t = 0; t < threads; ++t) {
+                    for (auto &e : buckets[t][j]) {
+                        size_t cc = 0;
+                        auto val = std::optional<std::reference_wrapper<const T>>(
+                            std::reference_wrapper<const T>((*e.second).second));
+                        table_descend(e.first, (*e.second).first, val,
+                                      Node::optype::insert, &cc);
+                        added += cc;
+                    }
+                }
+            }
+            total += added;
+        });
+        _root._count += total;
+    }
+    else {
+        build_subtrees(buckets, threads, run);
+    }
+
+    if (_filter_mask) {
+        for (auto &chunk : buckets)
+            for (auto &bucket : chunk)
+                for (auto &e : bucket)
+                    filter_add(e.first);
+    }
+    // Each key's pairs are in input order within its chunk's bucket
+    if (!_log.empty()) {
+        for (auto &chunk : buckets)
+            for (auto &bucket : chunk)
+                for (auto &e : bucket)
+                    log_change(e.first, DeltaOp::insert, (*e.second).first,
+                               &(*e.second).second);
+    }
+    if (_capacity && _root._count > _capacity)
+        evict(0, nullptr);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+template <class Buckets, class Run>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+build_subtrees(Buckets& buckets, const unsigned threads, Run& run)
+{
+    /* Root slots are voted (and copied if shared) up front, so that no
+     * worker touches the root */
+    std::array<Node *, nchldrn> subtrees;
+    for (int j = 0; j < nchldrn; ++j)
+        subtrees[j] = own_slot(_root.children, j);
+
+    /* Build: workers claim root slots and insert through the safe path
+     * starting at depth 1. New nodes come from each thread's own malloc
+     * arena, and the key counts are tallied per slot.
+     */
+    std::array<size_t, nchldrn> added = {};
+    std::atomic<int> next(0);
+    run([&](unsigned) {
+        for (int j = next++; j < nchldrn; j = next++) {
+            Node * sub = subtrees[j];
+            for (unsigned t = 0; t < threads; ++t) {
+                for (auto &e : buckets[t][j]) {
+                    if (nullptr == sub)
+                        sub = new SplitNode();
+                    size_t cc = 0;
+                    auto val = std::optional<std::reference_wrapper<const T>>(
+                            std::reference_wrapper<const T>((*e.second).second));
+                    sub->safe_traverse(e.first, (*e.second).first, val,
+                                       Node::optype::insert, 1, this, &cc);
+                    added[j] += cc;
+                }
+            }
+            subtrees[j] = sub;
+        }
+    });
+
+    /* Stitch the new subtrees in with replicated writes */
+    for (int j = 0; j < nchldrn; ++j) {
+        if (subtrees[j] != _root.children.get(j))
+            _root.children.set(j, subtrees[j]);
+        _root._count += added[j];
+    }
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+template <class Fn>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+for_each_entry(SplitNode * node, const int depth, const uint64_t prefix,
+               Fn& fn)
+{
+    for (int i = 0; i < nchldrn; ++i) {
+        Node * child = node->children.vote(i);
+        if (nullptr != child)
+            for_each_in_slot(child, depth,
+                    prefix | (uint64_t(i) << (nlog2chldrn * depth)), fn);
+    }
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+template <class Fn>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+for_each_in_slot(Node * child, const int depth, const uint64_t path, Fn& fn)
+{
+    if (depth < maxdepth - 1) {
+        for_each_entry(static_cast<SplitNode *>(child), depth + 1, path, fn);
+        return;
+    }
+    if constexpr (InlineEntry::enabled) {
+        if (InlineEntry::is(child)) {
+            fn(static_cast<HashType>(path), InlineEntry::key(child),
+               InlineEntry::value(child));
+            return;
+        }
+    }
+    LeafNode * leaf = static_cast<LeafNode *>(child);
+    leaf->scrub();
+    for (auto &kv : leaf->data)
+        fn(leaf->hashes[0], kv.first, kv.second);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+size_t
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+count_in_slot(Node * child, const int depth)
+{
+    if (InlineEntry::is(child))
+        return 1;
+    if (depth < maxdepth - 1)
+        return static_cast<SplitNode *>(child)->_count;
+    return static_cast<LeafNode *>(child)->data.size();
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+size_t
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+recount_node(SplitNode * node, const int depth)
+{
+    size_t n = 0;
+    for (int i = 0; i < nchldrn; ++i) {
+        Node * child = node->children.vote(i);
+        if (nullptr == child)
+            continue;
+        if (InlineEntry::is(child))
+            ++n;
+        else if (depth < maxdepth - 1)
+            n += recount_node(static_cast<SplitNode *>(child), depth + 1);
+        else
+            n += static_cast<LeafNode *>(child)->data.size();
+    }
+    node->_count = n;
+    return n;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+recount_path(const HashType& hash)
+{
+    // `path[k]` has its slots at depth `top + k`
+    const int top = _table_bits / nlog2chldrn;
+    std::array<SplitNode *, maxdepth> path;
+    int n = 0;
+    Node * child = &_root;
+    if (0 != _table_bits) {
+        int slot;
+        child = table_block(hash, slot).vote(slot);
+    }
+    for (int depth = top; nullptr != child && depth < maxdepth; ++depth) {
+        if (InlineEntry::is(child))
+            throw std::runtime_error("inline entry above the leaf level");
+        path[n++] = static_cast<SplitNode *>(child);
+        if (depth == maxdepth - 1)
+            break;
+        child = path[n-1]->children.vote(subhash(hash, depth));
+    }
+    for (int k = n - 1; k >= 0; --k) {
+        size_t total = 0;
+        for (int i = 0; i < nchldrn; ++i) {
+            Node * c = path[k]->children.vote(i);
+            if (nullptr != c)
+                total += count_in_slot(c, top + k);
+        }
+        path[k]->_count = total;
+    }
+
+    // Above a table, the root's count and the totals have to be summed
+    if (0 != _table_bits)
+        table_retally();
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+template <class Fn>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+for_each_entry(Fn& fn)
+{
+    if (0 == _table_bits) {
+        for_each_entry(&_root, 0, 0, fn);
+        return;
+    }
+    for (size_t b = 0; b < _table.size(); ++b) {
+        for (int slot = 0; slot < nchldrn; ++slot) {
+            Node * child = _table[b].vote(slot);
+            if (nullptr != child)
+                for_each_entry(static_cast<SplitNode *>(child),
+                        _table_bits / nlog2chldrn,
+                        b | (uint64_t(slot) << (_table_bits - nlog2chldrn)),
+                        fn);
+        }
+    }
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+for_each_root_slot(const std::vector<int>& slots, const unsigned threads,
+                   const std::function<void(int)>& fn)
+{
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t s = next++; s < slots.size(); s = next++)
+            fn(slots[s]);
+    };
+    if (threads <= 1 || slots.size() <= 1) {
+        worker();
+        return;
+    }
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < std::min<size_t>(threads, slots.size()); ++t)
+        pool.emplace_back(worker);
+    for (auto &th : pool)
+        th.join();
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+template <class Note>
+size_t
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+merge_nodes(SplitNode * mine, SplitNode * theirs, const int depth,
+            const uint64_t prefix, Note& note)
+{
+    size_t added = 0;
+    for (int i = 0; i < nchldrn; ++i) {
+        Node * t = theirs->children.vote(i);
+        Node * m = mine->children.vote(i);
+        if (nullptr == t || m == t)
+            continue;
+        const uint64_t path = prefix | (uint64_t(i) << (nlog2chldrn * depth));
+
+        if (nullptr == m) {
+            /* Adopt their subtree; it is copied on the first write */
+            if (!InlineEntry::is(t))
+                acquire(t);
+            mine->children.set(i, t);
+            const size_t n = count_in_slot(t, depth);
+            mine->_count += n;
+            added += n;
+            for_each_in_slot(t, depth, path, note);
+        }
+        else if (depth < maxdepth - 1) {
+            SplitNode * sub = static_cast<SplitNode *>(own_slot(mine->children, i));
+            const size_t n = merge_nodes(sub, static_cast<SplitNode *>(t),
+                                         depth + 1, path, note);
+            mine->_count += n;
+            added += n;
+        }
+        else {
+            /* Their entries go in through the safe path, which turns inline
+             * entries into leaves as needed and keeps `mine`'s count */
+            auto put = [&](const HashType hash, const Key& key, const T& val) {
+                size_t cc = 0;
+                mine->safe_traverse(hash, key,
+                        std::optional<std::reference_wrapper<const T>>(val),
+                        Node::optype::insert, depth, this, &cc);
+                added += cc;
+                note(hash, key, val);
+            };
+            for_each_in_slot(t, depth, path, put);
+        }
+    }
+    return added;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+template <class Gone>
+size_t
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+intersect_nodes(SplitNode * mine, SplitNode * theirs, const int depth,
+                const uint64_t prefix, Gone& gone)
+{
+    size_t removed = 0;
+    for (int i = 0; i < nchldrn; ++i) {
+        Node * m = mine->children.vote(i);
+        Node * t = theirs->children.vote(i);
+        if (nullptr == m || m == t)
+            continue;
+        const uint64_t path = prefix | (uint64_t(i) << (nlog2chldrn * depth));
+
+        if (nullptr == t) {
+            /* Drop our whole subtree */
+            auto drop_entry = [&](const HashType hash, const Key& key,
+                                  const T&) { gone(hash, key); };
+            for_each_in_slot(m, depth, path, drop_entry);
+            const size_t n = count_in_slot(m, depth);
+            mine->children.set(i, nullptr);
+            if (!InlineEntry::is(m))
+                unlink(m);
+            mine->_count -= n;
+            removed += n;
+        }
+        else if (depth < maxdepth - 1) {
+            SplitNode * sub = static_cast<SplitNode *>(own_slot(mine->children, i));
+            const size_t n = intersect_nodes(sub, static_cast<SplitNode *>(t),
+                                             depth + 1, path, gone);
+            mine->_count -= n;
+            removed += n;
+            prune_slot(mine->children, i);
+        }
+        else {
+            /* Find our keys that their slot lacks first, since removing
+             * them changes the slot */
+            std::vector<std::pair<HashType, Key>> lost;
+            auto check = [&](const HashType hash, const Key& key, const T&) {
+                bool found = false;
+                auto find = [&](const HashType, const Key& k, const T&) {
+                    found = found || key_equal()(k, key);
+                };
+                for_each_in_slot(t, depth, path, find);
+                if (!found)
+                    lost.emplace_back(hash, key);
+            };
+            for_each_in_slot(m, depth, path, check);
+            for (auto &e : lost) {
+                size_t cc = 0;
+                mine->safe_traverse(e.first, e.second,
+                        std::optional<std::reference_wrapper<const T>>(),
+                        Node::optype::remove, depth, this, &cc);
+                removed += cc;
+                gone(e.first, e.second);
+            }
+        }
+    }
+    return removed;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+template <class Fn>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+diff_slots(Node * mine, Node * theirs, const int depth, const uint64_t path,
+           Fn& fn)
+{
+    if (mine == theirs)
+        return;
+    if (nullptr == theirs || nullptr == mine) {
+        auto only = [&](const HashType, const Key& key, const T& val) {
+            if (nullptr == theirs)
+                fn(key, &val, static_cast<const T *>(nullptr));
+            else
+                fn(key, static_cast<const T *>(nullptr), &val);
+        };
+        for_each_in_slot(nullptr == theirs ? mine : theirs, depth, path, only);
+        return;
+    }
+    if (depth < maxdepth - 1) {
+        SplitNode * m = static_cast<SplitNode *>(mine);
+        SplitNode * t = static_cast<SplitNode *>(theirs);
+        for (int i = 0; i < nchldrn; ++i)
+            diff_slots(m->children.vote(i), t->children.vote(i), depth + 1,
+                       path | (uint64_t(i) << (nlog2chldrn * (depth + 1))), fn);
+        return;
+    }
+
+    /* Compare the two slots' (few) entries pairwise */
+    std::vector<std::pair<Key, T>> ours, others;
+    auto into = [](std::vector<std::pair<Key, T>>& v) {
+        return [&v](const HashType, const Key& key, const T& val) {
+            v.emplace_back(key, val);
+        };
+    };
+    auto put_ours = into(ours);
+    auto put_others = into(others);
+    for_each_in_slot(mine, depth, path, put_ours);
+    for_each_in_slot(theirs, depth, path, put_others);
+    std::vector<bool> matched(others.size(), false);
+    for (auto &o : ours) {
+        size_t j = 0;
+        while (j < others.size() && !key_equal()(others[j].first, o.first))
+            ++j;
+        if (j == others.size()) {
+            fn(o.first, &o.second, static_cast<const T *>(nullptr));
+            continue;
+        }
+        matched[j] = true;
+        if (!(o.second == others[j].second))
+            fn(o.first, &o.second, &others[j].second);
+    }
+    for (size_t j = 0; j < others.size(); ++j)
+        if (!matched[j])
+            fn(others[j].first, static_cast<const T *>(nullptr),
+               &others[j].second);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+size_t
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+merge(ReliableHAMT& other, unsigned threads)
+{
+    if (this == &other)
+        return 0;
+    EpochReclaimer::Guard guard;
+    const size_t before = _root._count;
+    if (0 != _table_bits || 0 != other._table_bits) {
+        std::vector<std::pair<Key, T>> entries;
+        auto gather = [&](const HashType, const Key& key, const T& val) {
+            entries.emplace_back(key, val);
+        };
+        other.for_each_entry(gather);
+        const size_t capacity = _capacity;
+        _capacity = 0;
+        build(entries.begin(), entries.end(), threads);
+        _capacity = capacity;
+        const size_t merged = _root._count - before;
+        if (_capacity && _root._count > _capacity)
+            evict(0, nullptr);
+        return merged;
+    }
+    // Adopted subtrees keep referring to `other`'s key bytes
+    if (_keys)
+        _keys->adopt(*other._keys);
+
+    /* Entries written below each root slot, for the filter and change log */
+    const bool noting = _filter_mask || !_log.empty();
+    std::array<std::vector<std::tuple<HashType, Key, T>>, nchldrn> written;
+
+    /* Root slots are settled here, so that workers never write the root */
+    std::vector<int> work;
+    std::array<Node *, nchldrn> theirs;
+    for (int i = 0; i < nchldrn; ++i) {
+        theirs[i] = other._root.children.vote(i);
+        Node * m = _root.children.vote(i);
+        if (nullptr == theirs[i] || m == theirs[i])
+            continue;
+        if (nullptr == m) {
+            acquire(theirs[i]);
+            _root.children.set(i, theirs[i]);
+            _root._count += count_in_slot(theirs[i], 0);
+            if (noting) {
+                auto note = [&](const HashType h, const Key& k, const T& v) {
+                    written[i].emplace_back(h, k, v);
+                };
+                for_each_in_slot(theirs[i], 0, i, note);
+            }
+            continue;
+        }
+        own_slot(_root.children, i);
+        work.push_back(i);
+    }
+
+    std::array<size_t, nchldrn> added = {};
+    for_each_root_slot(work, threads, [&](int i) {
+        auto note = [&](const HashType h, const Key& k, const T& v) {
+            if (noting)
+                written[i].emplace_back(h, k, v);
+        };
+        added[i] = merge_nodes(static_cast<SplitNode *>(_root.children.get(i)),
+                               static_cast<SplitNode *>(theirs[i]), 1, i, note);
+    });
+    for (int i : work)
+        _root._count += added[i];
+
+    for (auto &slot : written) {
+        for (auto &e : slot) {
+            if (_filter_mask)
+                filter_add(std::get<0>(e));
+            if (!_log.empty())
+                log_change(std::get<0>(e), DeltaOp::insert, std::get<1>(e),
+                           &std::get<2>(e));
+        }
+    }
+    const size_t merged = _root._count - before;
+    if (_capacity && _root._count > _capacity)
+        evict(0, nullptr);
+    return merged;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+size_t
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+intersect(ReliableHAMT& other, unsigned threads)
+{
+    if (this == &other)
+        return 0;
+    EpochReclaimer::Guard guard;
+    if (0 != _table_bits || 0 != other._table_bits) {
+        std::vector<Key> lost;
+        auto check = [&](const HashType, const Key& key, const T&) {
+            if (nullptr == other.read(key))
+                lost.push_back(key);
+        };
+        for_each_entry(check);
+        for (auto &key : lost)
+            remove(key);
+        return lost.size();
+    }
+
+    std::array<std::vector<std::pair<HashType, Key>>, nchldrn> removed_keys;
+    std::vector<int> work;
+    std::array<Node *, nchldrn> theirs;
+    for (int i = 0; i < nchldrn; ++i) {
+        theirs[i] = other._root.children.vote(i);
+        Node * m = _root.children.vote(i);
+        if (nullptr == m || m == theirs[i])
+            continue;
+        own_slot(_root.children, i);
+        work.push_back(i);
+    }
+
+    /* A slot they lack is cleared by the worker with an empty stand-in */
+    SplitNode empty;
+    std::array<size_t, nchldrn> removed = {};
+    for_each_root_slot(work, threads, [&](int i) {
+        auto gone = [&](const HashType h, const Key& k) {
+            if (!_log.empty())
+                removed_keys[i].emplace_back(h, k);
+        };
+        SplitNode * t = theirs[i] ? static_cast<SplitNode *>(theirs[i])
+                                  : &empty;
+        removed[i] = intersect_nodes(
+                static_cast<SplitNode *>(_root.children.get(i)), t, 1, i, gone);
+    });
+
+    size_t total = 0;
+    for (int i : work) {
+        _root._count -= removed[i];
+        total += removed[i];
+        prune_slot(_root.children, i);
+    }
+    for (auto &slot : removed_keys)
+        for (auto &e : slot)
+            log_change(e.first, DeltaOp::remove, e.second, nullptr);
+    return total;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+template <class Fn>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+diff(ReliableHAMT& other, Fn fn, unsigned threads)
+{
+    if (this == &other)
+        return;
+    EpochReclaimer::Guard guard;
+    if (0 != _table_bits || 0 != other._table_bits) {
+        auto mine = [&](const HashType, const Key& key, const T& val) {
+            const T * t = other.read(key);
+            if (nullptr == t || !(*t == val))
+                fn(key, &val, t);
+        };
+        for_each_entry(mine);
+        auto theirs = [&](const HashType, const Key& key, const T& val) {
+            if (nullptr == read(key))
+                fn(key, static_cast<const T *>(nullptr), &val);
+        };
+        other.for_each_entry(theirs);
+        return;
+    }
+
+    std::vector<int> work;
+    std::array<Node *, nchldrn> mine, theirs;
+    for (int i = 0; i < nchldrn; ++i) {
+        mine[i] = _root.children.vote(i);
+        theirs[i] = other._root.children.vote(i);
+        if (mine[i] != theirs[i])
+            work.push_back(i);
+    }
+    for_each_root_slot(work, threads, [&](int i) {
+        diff_slots(mine[i], theirs[i], 0, i, fn);
+    });
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+auto
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+scan_tasks(const unsigned threads) -> std::vector<ScanTask>
+{
+    const size_t target = std::max<size_t>(
+            1, _root._count / (8 * std::max(1u, threads)));
+    std::vector<ScanTask> tasks;
+    if (0 == _table_bits) {
+        for (int i = 0; i < nchldrn; ++i) {
+            Node * child = _root.children.vote(i);
+            if (nullptr != child)
+                split_task({ child, 0, uint64_t(i), count_in_slot(child, 0) },
+                           target, tasks);
+        }
+        return tasks;
+    }
+    // Entries in hash order, which is not block order past two levels
+    const int depth = _table_bits / nlog2chldrn - 1;
+    for (size_t m = 0; m < (size_t(1) << _table_bits); ++m) {
+        int slot;
+        const HashType j = table_hash(m);
+        Node * child = table_block(j, slot).vote(slot);
+        if (nullptr != child)
+            split_task({ child, depth, uint64_t(j),
+                         count_in_slot(child, depth) }, target, tasks);
+    }
+    return tasks;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+split_task(const ScanTask& task, const size_t target,
+           std::vector<ScanTask>& out)
+{
+    if (task.weight <= target || task.depth >= maxdepth - 1 ||
+            InlineEntry::is(task.child)) {
+        out.push_back(task);
+        return;
+    }
+    SplitNode * node = static_cast<SplitNode *>(task.child);
+    const int depth = task.depth + 1;
+    for (int i = 0; i < nchldrn; ++i) {
+        Node * child = node->children.vote(i);
+        if (nullptr != child)
+            split_task({ child, depth,
+                    task.path | (uint64_t(i) << (nlog2chldrn * depth)),
+                    count_in_slot(child, depth) }, target, out);
+    }
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+run_stealing(const std::vector<ScanTask>& tasks, const unsigned threads,
+             const std::function<void(size_t)>& fn)
+{
+    const size_t n = tasks.size();
+    const unsigned nthreads = std::min<size_t>(std::max(1u, threads), n);
+    if (nthreads <= 1) {
+        for (size_t i = 0; i < n; ++i)
+            fn(i);
+        return;
+    }
+
+    /* Thread `t` owns tasks [lo, hi) of its run, cut at equal shares of the
+     * total weight. It takes from the front of its own run and steals from
+     * the back of the others', so a thief leaves the owner its cache-warm
+     * neighbours. Tasks are whole subtrees, so one lock per run is cheap.
+     */
+    struct Run {
+        std::mutex lock;
+        size_t lo, hi;
+    };
+    std::vector<Run> runs(nthreads);
+    size_t total = 0;
+    for (auto &t : tasks)
+        total += t.weight;
+    size_t at = 0, sum = 0;
+    for (unsigned t = 0; t < nthreads; ++t) {
+        const size_t share = (t + 1 == nthreads)
+                ? SIZE_MAX : total / nthreads * (t + 1);
+        runs[t].lo = at;
+        while (at < n && (sum < share || runs[t].lo == at))
+            sum += tasks[at++].weight;
+        runs[t].hi = at;
+    }
+
+    auto worker = [&](const unsigned self) {
+        while (true) {
+            size_t task = n;
+            for (unsigned k = 0; k < nthreads && n == task; ++k) {
+                Run& run = runs[(self + k) % nthreads];
+                std::lock_guard<std::mutex> guard(run.lock);
+                if (run.lo < run.hi)
+                    task = (0 == k) ? run.lo++ : --run.hi;
+            }
+            if (n == task)
+                return;
+            fn(task);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < nthreads; ++t)
+        pool.emplace_back(worker, t);
+    worker(0);
+    for (auto &th : pool)
+        th.join();
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+template <class Fn>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+parallel_for_each(Fn fn, unsigned threads)
+{
+    EpochReclaimer::Guard guard;
+    const std::vector<ScanTask> tasks = scan_tasks(threads);
+    run_stealing(tasks, threads, [&](size_t i) {
+        auto visit = [&](const HashType, const Key& key, const T& val) {
+            fn(key, val);
+        };
+        for_each_in_slot(tasks[i].child, tasks[i].depth, tasks[i].path,
+                         visit);
+    });
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+template <class Map, class Reduce>
+auto
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+parallel_reduce(Map map_fn, Reduce reduce_fn, unsigned threads)
+    -> std::decay_t<std::invoke_result_t<Map&, const key_type&,
+                                         const mapped_type&>>
+{
+    using R = std::decay_t<std::invoke_result_t<Map&, const key_type&,
+                                                const mapped_type&>>;
+    EpochReclaimer::Guard guard;
+    const std::vector<ScanTask> tasks = scan_tasks(threads);
+    std::vector<std::optional<R>> partial(tasks.size());
+    run_stealing(tasks, threads, [&](size_t i) {
+        std::optional<R>& acc = partial[i];
+        auto fold = [&](const HashType, const Key& key, const T& val) {
+            if (acc)
+                acc = reduce_fn(std::move(*acc), map_fn(key, val));
+            else
+                acc = map_fn(key, val);
+        };
+        for_each_in_slot(tasks[i].child, tasks[i].depth, tasks[i].path,
+                         fold);
+    });
+
+    std::optional<R> result;
+    for (auto &p : partial) {
+        if (!p)
+            continue;
+        if (result)
+            result = reduce_fn(std::move(*result), std::move(*p));
+        else
+            result = std::move(p);
+    }
+    return result ? std::move(*result) : R();
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+inline uint64_t
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+filter_probe(const HashType hash, const int i)
+{
+    // Double hashing over a splitmix64 finalisation of the trie hash
+    uint64_t x = static_cast<uint64_t>(hash) + 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return (x >> 32) + i * (x | 1);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+bool
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+filter_excludes(const HashType& hash) const
+{
+    if (0 == _filter_mask)
+        return false;
+    for (int i = 0; i < filter_probes; ++i) {
+        const uint64_t bit = filter_probe(hash, i) & _filter_mask;
+        const uint64_t mask = uint64_t(1) << (bit & 63);
+        if (__atomic_load_n(&_filter[0][bit >> 6], __ATOMIC_RELAXED) & mask)
+            continue;
+        bool absent = true;
+        for (unsigned c = 1; c <= FT; ++c)
+            absent = absent && !(__atomic_load_n(&_filter[c][bit >> 6],
+                                                 __ATOMIC_RELAXED) & mask);
+        if (absent)
+            return true;
+    }
+    return false;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+filter_add(const HashType& hash)
+{
+    for (int i = 0; i < filter_probes; ++i) {
+        // Words are read alongside the writer, who alone sets bits
+        const uint64_t bit = filter_probe(hash, i) & _filter_mask;
+        for (auto &copy : _filter)
+            __atomic_store_n(&copy[bit >> 6], copy[bit >> 6] |
+                             (uint64_t(1) << (bit & 63)), __ATOMIC_RELAXED);
+    }
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+set_negative_filter(size_t nbits)
+{
+    EpochReclaimer::Guard guard;
+    _filter_mask = 0;
+    if (0 == nbits) {
+        for (auto &copy : _filter)
+            std::vector<uint64_t>().swap(copy);
+        return;
+    }
+
+    size_t bits = 64;
+    while (bits < nbits)
+        bits <<= 1;
+    for (auto &copy : _filter)
+        copy.assign(bits / 64, 0);
+    _filter_mask = bits - 1;
+
+    auto add = [this](const HashType hash, const Key&, const T&) {
+        filter_add(hash);
+    };
+    for_each_entry(add);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+set_change_log(size_t capacity)
+{
+    std::vector<LogRecord>(capacity).swap(_log);
+    _log_count = 0;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+set_change_log(size_t capacity, uint64_t seq)
+{
+    set_change_log(capacity);
+    _log_seq = seq;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+inline void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+log_change(const HashType& hash, const DeltaOp op, const Key& key,
+           const T * val)
+{
+    LogRecord& rec = _log[_log_seq++ % _log.size()];
+    rec.hash = hash;
+    rec.op = op;
+    rec.key = key;
+    if (val)
+        rec.value = *val;
+    else
+        rec.value.reset();
+    _log_count = std::min(_log_count + 1, _log.size());
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+size_t
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+drain_changes(std::string& out)
+{
+    if (_log.empty())
+        return 0;
+    DeltaHeader h = { DeltaHeader::magic_value, uint32_t(_log_count),
+                      _log_seq - _log_count, 0, 0 };
+    const size_t at = out.size();
+    out.append(sizeof(h), '\0');
+    for (uint64_t seq = h.first; seq < _log_seq; ++seq) {
+        const LogRecord& rec = _log[seq % _log.size()];
+        DeltaCodec<uint8_t>::put(out, uint8_t(rec.op));
+        DeltaCodec<HashType>::put(out, rec.hash);
+        DeltaCodec<typename KeyStore<Key>::owned_type>::put(out, rec.key);
+        if (DeltaOp::insert == rec.op)
+            DeltaCodec<T>::put(out, *rec.value);
+    }
+    h.length = out.size() - at - sizeof(h);
+    h.checksum = WyMix::bytes(out.data() + at + sizeof(h), h.length);
+    std::memcpy(&out[at], &h, sizeof(h));
+    _log_count = 0;
+    return h.count;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+uint64_t
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+apply_delta(const std::string& deltas, uint64_t next, unsigned threads)
+{
+    /* Decode and check everything before touching the trie */
+    std::vector<LogRecord> changes;
+    const char * p = deltas.data();
+    const char * const end = p + deltas.size();
+    while (p != end) {
+        DeltaHeader h;
+        if (size_t(end - p) < sizeof(h))
+            throw std::runtime_error("truncated delta");
+        std::memcpy(&h, p, sizeof(h));
+        p += sizeof(h);
+        if (DeltaHeader::magic_value != h.magic ||
+                size_t(end - p) < h.length ||
+                WyMix::bytes(p, h.length) != h.checksum)
+            throw std::runtime_error("corrupt delta");
+        if (h.first > next)
+            throw std::runtime_error("changes missing from delta stream, "
+                                     "full resync required");
+
+        const char * const rend = p + h.length;
+        for (uint32_t i = 0; i < h.count; ++i) {
+            LogRecord rec;
+            uint8_t op = 0;
+            bool ok = DeltaCodec<uint8_t>::get(p, rend, op) &&
+                      DeltaCodec<HashType>::get(p, rend, rec.hash) &&
+                      DeltaCodec<typename KeyStore<Key>::owned_type>::get(
+                              p, rend, rec.key);
+            rec.op = DeltaOp(op);
+            if (ok && DeltaOp::insert == rec.op) {
+                T val = T();
+                ok = DeltaCodec<T>::get(p, rend, val);
+                rec.value = std::move(val);
+            }
+            else if (ok && DeltaOp::remove != rec.op) {
+                ok = false;
+            }
+            if (!ok)
+                throw std::runtime_error("corrupt delta");
+            if (hash_of(rec.key) != rec.hash)
+                throw std::runtime_error("delta key hashes differently here");
+            if (h.first + i >= next)
+                changes.push_back(std::move(rec));
+        }
+        if (p != rend)
+            throw std::runtime_error("corrupt delta");
+        next = std::max<uint64_t>(next, h.first + h.count);
+    }
+
+    /* Keep the last change to each key */
+    std::unordered_set<Key, Hash, Pred> seen;
+    std::vector<std::pair<Key, T>> inserts;
+    for (auto it = changes.rbegin(); it != changes.rend(); ++it) {
+        if (!seen.insert(it->key).second)
+            continue;
+        if (DeltaOp::remove == it->op)
+            remove(it->key);
+        else
+            inserts.emplace_back(std::move(it->key), std::move(*it->value));
+    }
+    build(inserts.begin(), inserts.end(), threads);
+    return next;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+const T *
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+insert(const Key& key, const T& tval)
+{
+    return insert_hashed(hash_of(key), key, tval);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+const T *
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+insert_hashed(const HashType& hash, const Key& key, const T& tval)
+{
+    EpochReclaimer::Guard guard;
+    size_t cc;
+    const mapped_type * rv;
+    auto val = std::optional<std::reference_wrapper<const T>>(
+            std::reference_wrapper<const T>(tval));
+    rv = root_fast(hash, key, val, Node::optype::insert, &cc);
+    if (_filter_mask)
+        filter_add(hash);
+    if (!_log.empty())
+        log_change(hash, DeltaOp::insert, key, &tval);
+    if (_capacity && _root._count > _capacity)
+        evict(hash, &key);
+    return rv;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+int
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+remove(const Key& key)
+{
+    return remove_hashed(hash_of(key), key);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+template <class K, class>
+int
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+remove(const K& key)
+{
+    const HashType hash = hash_of(key);
+    if (nullptr == read_hashed(hash, key))
+        return 0;
+    return remove_hashed(hash, Key(key));
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+int
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+remove_hashed(const HashType& hash, const Key& key)
+{
+    EpochReclaimer::Guard guard;
+    if (filter_excludes(hash))
+        return 0;
+    size_t cc;
     auto val = std::optional<std::reference_wrapper<const T>>();
-    rv = _root.fast_traverse(
-            hash, key, val, Node::optype::read, 0, &_root, &cc);
+    int rv = reinterpret_cast<uintptr_t>(
+                root_fast(hash, key, val, Node::optype::remove, &cc));
+    if (rv && !_log.empty())
+        log_change(hash, DeltaOp::remove, key, nullptr);
     return rv;
 }
 
 
-template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred, class Alloc>
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+const T *
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+read(const Key& key)
+{
+    return read_hashed(hash_of(key), key);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+const T *
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+read_hashed(const HashType& hash, const Key& key)
+{
+    EpochReclaimer::Guard guard;
+    if (filter_excludes(hash))
+        return nullptr;
+    size_t cc;
+    const mapped_type * rv;
+    auto val = std::optional<std::reference_wrapper<const T>>();
+    rv = root_fast(hash, key, val, Node::optype::read, &cc);
+    return rv;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+template <class K, class>
+const T *
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+read_hashed(const HashType& hash, const K& key)
+{
+    EpochReclaimer::Guard guard;
+    if (filter_excludes(hash))
+        return nullptr;
+    return find_fast(hash, key);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+template <class K>
+std::optional<T>
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+find_copy(const HashType& hash, const K& key)
+{
+    /* The entry found stays allocated until the guard is dropped, however
+     * the writer changes the key meanwhile */
+    EpochReclaimer::Guard guard;
+    if (filter_excludes(hash))
+        return std::nullopt;
+    Node * entry = nullptr;
+    const T * rv = find_fast(hash, key, &entry);
+    if (nullptr == rv)
+        return std::nullopt;
+    if constexpr (InlineEntry::enabled) {
+        if (nullptr != entry)
+            return InlineEntry::value(entry);
+    }
+    return *rv;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+template <class K>
+const T *
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+find_fast(const HashType& hash, const K& key, Node ** entry)
+{
+    /* As the fast traversal: an empty root slot is voted on, any other empty
+     * slot, misplaced inline entry or leaf for another hash sends us to the
+     * voted descent, and so does a fault.
+     */
+    static const bool installed = install_sigsegv_handler();
+    (void)installed;
+    if (setjmp(env) > 0)
+        return find_safe(hash, key, entry);
+    env_armed = 1;
+
+    // `child` is found in a slot at `depth`
+    int depth;
+    Node * child;
+    if (0 == _table_bits) {
+        depth = 0;
+        const int idx = subhash(hash, 0);
+        child = _root.children.get(idx);
+        if (nullptr == child) {
+            try {
+                child = _root.children.vote(idx);
+            }
+            catch (const std::runtime_error& e) { }
+            if (nullptr == child) {
+                env_armed = 0;
+                return nullptr;
+            }
+        }
+    }
+    else {
+        int slot;
+        depth = _table_bits / nlog2chldrn - 1;
+        child = table_block(hash, slot).get(slot);
+    }
+
+    SplitNode * parent = nullptr;
+    while (nullptr != child && !InlineEntry::is(child) &&
+            depth < maxdepth - 1) {
+        parent = static_cast<SplitNode *>(child);
+        child = parent->children.get(subhash(hash, ++depth));
+    }
+
+    const T * rv = nullptr;
+    bool found = false;
+    if (nullptr == child || depth < maxdepth - 1) {
+        // A miss (or the wrong path) is settled by voting
+    }
+    else if (InlineEntry::is(child)) {
+        if constexpr (InlineEntry::enabled) {
+            if (nullptr != parent &&
+                    key_equal()(InlineEntry::key(child), key)) {
+                rv = InlineEntry::value_ptr(
+                        parent->children.raw(subhash(hash, depth), 0));
+                if (nullptr != entry)
+                    *entry = child;
+                found = true;
+            }
+        }
+    }
+    else {
+        LeafNode * leaf = static_cast<LeafNode *>(child);
+        if (leaf->check_hash(hash, this)) {
+            found = true;
+            for (auto &it : leaf->data) {
+                if (leaf->key_eq(it.first, key)) {
+                    rv = &it.second;
+                    break;
+                }
+            }
+        }
+    }
+    if (nullptr != rv && nullptr != parent && _capacity)
+        parent->note_use(subhash(hash, depth), Node::optype::read, true, 0);
+    env_armed = 0;
+    return found ? rv : find_safe(hash, key, entry);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+template <class K>
+const T *
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+find_safe(const HashType& hash, const K& key, Node ** entry)
+{
+    int depth;
+    Node * child;
+    SplitNode * parent = nullptr;
+    if (0 == _table_bits) {
+        depth = 0;
+        parent = &_root;
+        child = _root.children.vote(subhash(hash, 0));
+    }
+    else {
+        int slot;
+        depth = _table_bits / nlog2chldrn - 1;
+        child = table_block(hash, slot).vote(slot);
+    }
+    while (nullptr != child && depth < maxdepth - 1) {
+        if (InlineEntry::is(child))
+            throw std::runtime_error("inline entry above the leaf level");
+        parent = static_cast<SplitNode *>(child);
+        child = parent->children.vote(subhash(hash, ++depth));
+    }
+    if (nullptr == child)
+        return nullptr;
+
+    const T * rv = nullptr;
+    if (InlineEntry::is(child)) {
+        if constexpr (InlineEntry::enabled) {
+            if (key_equal()(InlineEntry::key(child), key)) {
+                rv = InlineEntry::value_ptr(
+                        parent->children.raw(subhash(hash, depth), 0));
+                if (nullptr != entry)
+                    *entry = child;
+            }
+        }
+    }
+    else {
+        LeafNode * leaf = static_cast<LeafNode *>(child);
+        leaf->vote_hashes();
+        if (hash != leaf->hashes[0])
+            throw std::runtime_error("leaf hash does not match its path");
+        for (auto &it : leaf->data) {
+            if (leaf->key_eq(it.first, key)) {
+                rv = &it.second;
+                break;
+            }
+        }
+    }
+    if (nullptr != rv && nullptr != parent && _capacity)
+        parent->note_use(subhash(hash, depth), Node::optype::read, true, 0);
+    return rv;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+size_t
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+slot_counts(SplitNode * node, const int depth,
+            std::array<Node *, nchldrn>& kids,
+            std::array<size_t, nchldrn>& counts)
+{
+    // The children are usually cold, so they are all fetched before any
+    // count is read
+    for (int i = 0; i < nchldrn; ++i) {
+        kids[i] = node->children.vote(i);
+        if (nullptr == kids[i] || InlineEntry::is(kids[i])) {
+            if (nullptr != kids[i] && depth < maxdepth - 1)
+                throw std::runtime_error("inline entry above the leaf level");
+            continue;
+        }
+        if (depth < maxdepth - 1)
+            __builtin_prefetch(&static_cast<SplitNode *>(kids[i])->_count);
+        else
+            __builtin_prefetch(&static_cast<LeafNode *>(kids[i])->data);
+    }
+    size_t total = 0;
+    for (int i = 0; i < nchldrn; ++i) {
+        counts[i] = nullptr == kids[i] ? 0 : count_in_slot(kids[i], depth);
+        total += counts[i];
+    }
+    if (total == node->_count)
+        return total;
+
+    /* Counts are not replicated, so a wrong one (the parent's or a child's)
+     * is found by comparing them, and mended by counting the entries */
+    total = recount_node(node, depth);
+    for (int i = 0; i < nchldrn; ++i)
+        counts[i] = nullptr == kids[i] ? 0 : count_in_slot(kids[i], depth);
+    return total;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+size_t
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+table_order(const HashType& hash) const
+{
+    // The subhashes of the table's levels, the first one most significant
+    const int levels = _table_bits / nlog2chldrn;
+    size_t m = 0;
+    for (int d = 0; d < levels; ++d)
+        m = (m << nlog2chldrn) | subhash(hash, d);
+    return m;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+HashType
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+table_hash(const size_t m) const
+{
+    const int levels = _table_bits / nlog2chldrn;
+    HashType hash = 0;
+    for (int d = 0; d < levels; ++d)
+        hash |= HashType((m >> (nlog2chldrn * (levels - 1 - d))) &
+                         (nchldrn - 1)) << (nlog2chldrn * d);
+    return hash;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+bool
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+table_children(const int d, const size_t p, std::array<Node *, nchldrn>& kids,
+               std::array<size_t, nchldrn>& counts)
+{
+    const int levels = _table_bits / nlog2chldrn;
+    size_t total = 0;
+    for (int c = 0; c < nchldrn; ++c) {
+        const size_t q = p * nchldrn + c;
+        kids[c] = nullptr;
+        if (d < levels - 1) {
+            counts[c] = _table_totals[table_level(d + 1) + q];
+        }
+        else {
+            int slot;
+            kids[c] = table_block(table_hash(q), slot).vote(slot);
+            if (nullptr != kids[c] && InlineEntry::is(kids[c]))
+                throw std::runtime_error("inline entry in the root table");
+            counts[c] = nullptr == kids[c] ? 0
+                                           : count_in_slot(kids[c], levels - 1);
+        }
+        total += counts[c];
+    }
+    return total == (0 == d ? _root._count : _table_totals[table_level(d) + p]);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+auto
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+nth_by_hash(size_t i) -> std::optional<value_type>
+{
+    EpochReclaimer::Guard guard;
+    // `node` has its slots at `depth`
+    SplitNode * node = &_root;
+    int depth = 0;
+    std::array<Node *, nchldrn> kids;
+    std::array<size_t, nchldrn> counts;
+    if (0 != _table_bits) {
+        /* Down the table's levels by their totals. Those that disagree with
+         * their parts are all recomputed, and the walk starts over. */
+        const int levels = _table_bits / nlog2chldrn;
+        const size_t want = i;
+        bool retallied = false;
+        size_t p = 0;
+        for (int d = 0; d < levels; ++d) {
+            if (!table_children(d, p, kids, counts)) {
+                if (retallied)
+                    throw std::runtime_error("root table totals do not add up");
+                table_retally();
+                retallied = true;
+                i = want;
+                p = 0;
+                d = -1;
+                continue;
+            }
+            if (0 == d && i >= _root._count)
+                return std::nullopt;
+            int c = 0;
+            for (; i >= counts[c]; ++c)
+                i -= counts[c];
+            p = p * nchldrn + c;
+            node = static_cast<SplitNode *>(kids[c]);
+        }
+        depth = levels;
+    }
+
+    for (;; ++depth) {
+        if (i >= slot_counts(node, depth, kids, counts))
+            return std::nullopt;
+        int c = 0;
+        for (; i >= counts[c]; ++c)
+            i -= counts[c];
+        if (depth < maxdepth - 1) {
+            node = static_cast<SplitNode *>(kids[c]);
+            continue;
+        }
+
+        if (InlineEntry::is(kids[c])) {
+            if constexpr (InlineEntry::enabled)
+                return value_type(InlineEntry::key(kids[c]),
+                                  InlineEntry::value(kids[c]));
+            return std::nullopt;
+        }
+        LeafNode * leaf = static_cast<LeafNode *>(kids[c]);
+        leaf->scrub();
+        return *std::next(leaf->data.begin(), i);
+    }
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+size_t
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+rank(const Key& key)
+{
+    EpochReclaimer::Guard guard;
+    const HashType hash = hash_of(key);
+    size_t before = 0;
+    SplitNode * node = &_root;
+    int depth = 0;
+    std::array<Node *, nchldrn> kids;
+    std::array<size_t, nchldrn> counts;
+    if (0 != _table_bits) {
+        // As in `nth_by_hash`, along the prefixes of the key's entry
+        const int levels = _table_bits / nlog2chldrn;
+        const size_t m = table_order(hash);
+        bool retallied = false;
+        for (int d = 0; d < levels; ++d) {
+            const size_t p = m >> (nlog2chldrn * (levels - d));
+            if (!table_children(d, p, kids, counts)) {
+                if (retallied)
+                    throw std::runtime_error("root table totals do not add up");
+                table_retally();
+                retallied = true;
+                before = 0;
+                d = -1;
+                continue;
+            }
+            const int s = (m >> (nlog2chldrn * (levels - 1 - d))) &
+                          (nchldrn - 1);
+            for (int c = 0; c < s; ++c)
+                before += counts[c];
+        }
+        const int s = m & (nchldrn - 1);
+        if (nullptr == kids[s])
+            return before;
+        node = static_cast<SplitNode *>(kids[s]);
+        depth = levels;
+    }
+
+    for (;; ++depth) {
+        slot_counts(node, depth, kids, counts);
+        const int s = subhash(hash, depth);
+        for (int c = 0; c < s; ++c)
+            before += counts[c];
+        if (nullptr == kids[s])
+            return before;
+        if (depth < maxdepth - 1) {
+            node = static_cast<SplitNode *>(kids[s]);
+            continue;
+        }
+
+        /* Keys sharing the full hash: one inline entry, or a leaf's chain.
+         * A missing key would be added after them. */
+        if (InlineEntry::is(kids[s])) {
+            if constexpr (InlineEntry::enabled)
+                return before + (key_equal()(InlineEntry::key(kids[s]), key)
+                                 ? 0 : 1);
+            return before;
+        }
+        LeafNode * leaf = static_cast<LeafNode *>(kids[s]);
+        leaf->vote_hashes();
+        if (hash != leaf->hashes[0])
+            throw std::runtime_error("leaf hash does not match its path");
+        for (auto &it : leaf->data) {
+            if (leaf->key_eq(it.first, key))
+                return before;
+            ++before;
+        }
+        return before;
+    }
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+set_verification(const verify mode, const unsigned period)
+{
+    _verify = mode;
+    _verify_period = period ? period : 1;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+size_t
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+scrub()
+{
+    EpochReclaimer::Guard guard;
+    size_t checked = _root.scrub();
+    for (auto &block : _table) {
+        for (int slot = 0; slot < nchldrn; ++slot) {
+            Node * child = block.vote(slot);
+            if (nullptr != child)
+                checked += child->scrub();
+        }
+    }
+    return checked;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+size_t
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+inspect_node(SplitNode * node, const int depth, Stats& stats)
+{
+    static constexpr size_t replicas = Slots::bytes - nchldrn * sizeof(Node *);
+    ++stats.split_nodes[depth];
+    stats.replica_bytes += replicas;
+    stats.structure_bytes += sizeof(SplitNode) - sizeof(Slots) +
+                             nchldrn * sizeof(Node *);
+
+    size_t keys = 0;
+    int used = 0;
+    for (int i = 0; i < nchldrn; ++i) {
+        Node * child = node->children.vote(i);
+        if (nullptr == child)
+            continue;
+        ++used;
+        if (InlineEntry::is(child)) {
+            ++stats.inline_entries;
+            stats.payload_bytes += sizeof(Key) + sizeof(T);
+            stats.structure_bytes -= sizeof(Key) + sizeof(T);
+            ++keys;
+        }
+        else if (depth < maxdepth - 1) {
+            keys += inspect_node(static_cast<SplitNode *>(child), depth + 1,
+                                 stats);
+        }
+        else {
+            LeafNode * leaf = static_cast<LeafNode *>(child);
+            leaf->scrub();
+            const size_t n = leaf->data.size();
+            ++stats.leaves;
+            if (stats.chains.size() <= n)
+                stats.chains.resize(n + 1);
+            ++stats.chains[n];
+            stats.replica_bytes += (ft - 1) * sizeof(HashType);
+            stats.structure_bytes += sizeof(LeafNode) -
+                                     (ft - 1) * sizeof(HashType);
+            // Each chain entry is the pair plus one link
+            stats.payload_bytes += n * (sizeof(Key) + sizeof(T));
+            stats.structure_bytes += n * (sizeof(typename Chain::Entry) -
+                    sizeof(Key) - sizeof(T));
+            keys += n;
+        }
+    }
+    ++stats.occupancy[used];
+    if (depth > 0 && node->_count != keys)
+        ++stats.count_mismatches;
+    return keys;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+auto
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+inspect() -> Stats
+{
+    EpochReclaimer::Guard guard;
+    Stats stats;
+    stats.split_nodes.assign(maxdepth, 0);
+    stats.occupancy.assign(nchldrn + 1, 0);
+    stats.structure_bytes = sizeof(*this) - sizeof(SplitNode);
+
+    size_t keys;
+    if (0 == _table_bits) {
+        keys = inspect_node(&_root, 0, stats);
+    }
+    else {
+        /* The table stands in for the levels it replaces */
+        static constexpr size_t replicas =
+                Slots::bytes - nchldrn * sizeof(Node *);
+        keys = 0;
+        stats.replica_bytes += _table.size() * replicas;
+        stats.structure_bytes += _table.size() * nchldrn * sizeof(Node *) +
+                                 _table_totals.size() * sizeof(size_t) +
+                                 sizeof(SplitNode);
+        for (auto &block : _table) {
+            for (int slot = 0; slot < nchldrn; ++slot) {
+                Node * child = block.vote(slot);
+                if (nullptr != child)
+                    keys += inspect_node(static_cast<SplitNode *>(child),
+                                         _table_bits / nlog2chldrn, stats);
+            }
+        }
+    }
+    if (_root._count != keys)
+        ++stats.count_mismatches;
+    stats.entries = keys;
+
+    if (_filter_mask) {
+        stats.structure_bytes += _filter[0].size() * sizeof(uint64_t);
+        stats.replica_bytes += FT * _filter[0].size() * sizeof(uint64_t);
+    }
+    stats.structure_bytes += _log.capacity() * sizeof(LogRecord);
+    if (_keys)
+        stats.payload_bytes += _keys->bytes();
+    return stats;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+void
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+Stats::print(std::ostream& os) const
+{
+    os << "entries " << entries << " (" << inline_entries << " inline), "
+       << leaves << " leaves, " << count_mismatches << " count mismatches\n";
+    os << "split nodes by depth:";
+    for (size_t n : split_nodes)
+        os << ' ' << n;
+    os << "\nslot occupancy:";
+    for (size_t k = 0; k < occupancy.size(); ++k)
+        if (occupancy[k])
+            os << ' ' << k << ':' << occupancy[k];
+    os << "\nleaf chain lengths:";
+    for (size_t n = 0; n < chains.size(); ++n)
+        if (chains[n])
+            os << ' ' << n << ':' << chains[n];
+    os << "\nbytes: " << payload_bytes << " payload, " << replica_bytes
+       << " replicas, " << structure_bytes << " structure, "
+       << bytes_per_key() << " per key\n";
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
 bool
-ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc>::
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
 empty() const
 {
     return (0 == _root.getCount());
 }
 
 
-template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred, class Alloc>
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
 size_t
-ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc>::
+ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
 size() const
 {
     return _root.getCount();
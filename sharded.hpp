@@ -0,0 +1,295 @@
+#ifndef _SHARDED_HPP
+#define _SHARDED_HPP
+#include "rhamt.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Front-end that partitions keys across `2^shard_bits` independent
+ * ReliableHAMTs by the top bits of the key's hash. Each shard has its own
+ * lock and its own root, so faults are detected and repaired within the
+ * shard they occur in, and writers to different shards never contend.
+ *
+ * The trie consumes the hash from the low bits up, so selecting the shard by
+ * the top bits leaves the upper levels of every shard fully spread out.
+ */
+template <class Key, class T, unsigned FT = 0, class HashType = uint32_t,
+          class Hash = MixHash<Key>, class Pred = std::equal_to<Key>,
+          class Alloc = std::allocator<std::pair<const Key, T>>,
+          template <class, size_t, unsigned> class Protect = ReplicatedSlots>
+class ShardedReliableHAMT {
+public:
+    // types
+    typedef ReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>
+                                                        shard_type;
+    typedef Key                                         key_type;
+    typedef T                                           mapped_type;
+    typedef HashType                                    hash_type;
+    typedef Hash                                        hasher;
+    typedef std::pair<const key_type, mapped_type>      value_type;
+
+    explicit ShardedReliableHAMT(unsigned shard_bits = 4);
+    ~ShardedReliableHAMT() {};
+
+    bool   empty() const;
+    size_t size() const;
+    size_t nshards() const { return _nshards; };
+
+    /* Single-key operations lock only the owning shard. Returned pointers
+     * are only stable until the next write to that shard.
+     */
+    const mapped_type * insert(const key_type&, const mapped_type&);
+    int remove(const key_type&);
+    const mapped_type * read(const key_type&);
+
+    /* Batched operations take forward iterators, group the range by shard
+     * and take each shard's lock once per batch. With `threads` > 1, shards
+     * are handed out to worker threads, so a batch spanning many shards is
+     * applied in parallel.
+     */
+    template <class InputIt>
+    void insert(InputIt first, InputIt last, unsigned threads = 1);
+    template <class InputIt>
+    size_t remove(InputIt first, InputIt last, unsigned threads = 1);
+    // Writes one `const mapped_type *` per key, in input order, to `out`
+    template <class InputIt, class OutputIt>
+    void read(InputIt first, InputIt last, OutputIt out, unsigned threads = 1);
+
+protected:
+    static constexpr int soh = sizeof(HashType) * 8;
+
+    /* Padded so that neighbouring shards' locks do not share a cache line */
+    struct alignas(64) Shard {
+        mutable std::mutex lock;
+        shard_type rhamt;
+    };
+
+    unsigned _shard_bits;
+    size_t _nshards;
+    std::unique_ptr<Shard[]> _shards;
+    hasher hasher_function;
+
+    /* Keys are hashed once, here, and the hash is handed to the shard */
+    hash_type hash_of(const key_type& key) const
+        { return fold_hash<HashType>(hasher_function(key)); }
+    size_t shard_of(const hash_type&) const;
+
+    /* A batch entry: its position in the batch, iterator and hash */
+    template <class It>
+    struct Item {
+        size_t pos;
+        It it;
+        hash_type hash;
+    };
+    /* Batch entries grouped by shard */
+    template <class It>
+    using Buckets = std::vector<std::vector<Item<It>>>;
+
+    /* Group a (forward) range by shard, keeping input order within each
+     * bucket so that later duplicates still win on insert.
+     */
+    template <class It, class KeyOf>
+    Buckets<It> partition(It first, It last, KeyOf key_of) const;
+    /* Run `fn(shard_idx)` under the shard's lock for every non-empty bucket */
+    template <class It, class Fn>
+    void for_each_shard(const Buckets<It>&, unsigned threads, Fn fn);
+};
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+ShardedReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+ShardedReliableHAMT(unsigned shard_bits)
+    : _shard_bits(shard_bits), _nshards(size_t(1) << shard_bits)
+{
+    if (shard_bits > 16 || (int)shard_bits >= soh)
+        throw std::out_of_range("shard_bits must be < 17 and < hash width");
+    _shards = std::unique_ptr<Shard[]>(new Shard[_nshards]);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+inline size_t
+ShardedReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+shard_of(const HashType& hash) const
+{
+    if (0 == _shard_bits)
+        return 0;
+    return static_cast<size_t>(hash >> (soh - _shard_bits));
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+const T *
+ShardedReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+insert(const Key& key, const T& val)
+{
+    const HashType hash = hash_of(key);
+    Shard& shard = _shards[shard_of(hash)];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    return shard.rhamt.insert_hashed(hash, key, val);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+int
+ShardedReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+remove(const Key& key)
+{
+    const HashType hash = hash_of(key);
+    Shard& shard = _shards[shard_of(hash)];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    return shard.rhamt.remove_hashed(hash, key);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+const T *
+ShardedReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+read(const Key& key)
+{
+    const HashType hash = hash_of(key);
+    Shard& shard = _shards[shard_of(hash)];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    return shard.rhamt.read_hashed(hash, key);
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+template <class It, class KeyOf>
+auto
+ShardedReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+partition(It first, It last, KeyOf key_of) const -> Buckets<It>
+{
+    Buckets<It> buckets(_nshards);
+    size_t pos = 0;
+    for (It it = first; it != last; ++it, ++pos) {
+        const HashType hash = hash_of(key_of(*it));
+        buckets[shard_of(hash)].push_back(Item<It>{pos, it, hash});
+    }
+    return buckets;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+template <class It, class Fn>
+void
+ShardedReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+for_each_shard(const Buckets<It>& buckets, unsigned threads, Fn fn)
+{
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t s = next++; s < _nshards; s = next++) {
+            if (buckets[s].empty())
+                continue;
+            std::lock_guard<std::mutex> guard(_shards[s].lock);
+            fn(s);
+        }
+    };
+
+    if (threads <= 1) {
+        worker();
+        return;
+    }
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads; ++i)
+        pool.emplace_back(worker);
+    for (auto &t : pool)
+        t.join();
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+template <class InputIt>
+void
+ShardedReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+insert(InputIt first, InputIt last, unsigned threads)
+{
+    auto buckets = partition(first, last,
+                        [](const auto& kv) -> const Key& { return kv.first; });
+    for_each_shard(buckets, threads, [&](size_t s) {
+        for (auto &item : buckets[s])
+            _shards[s].rhamt.insert_hashed(item.hash, item.it->first,
+                                           item.it->second);
+    });
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+template <class InputIt>
+size_t
+ShardedReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+remove(InputIt first, InputIt last, unsigned threads)
+{
+    auto buckets = partition(first, last,
+                             [](const Key& k) -> const Key& { return k; });
+    std::atomic<size_t> removed(0);
+    for_each_shard(buckets, threads, [&](size_t s) {
+        size_t n = 0;
+        for (auto &item : buckets[s])
+            n += _shards[s].rhamt.remove_hashed(item.hash, *item.it);
+        removed += n;
+    });
+    return removed;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+template <class InputIt, class OutputIt>
+void
+ShardedReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+read(InputIt first, InputIt last, OutputIt out, unsigned threads)
+{
+    auto buckets = partition(first, last,
+                             [](const Key& k) -> const Key& { return k; });
+    std::vector<const T *> results(std::distance(first, last), nullptr);
+    for_each_shard(buckets, threads, [&](size_t s) {
+        for (auto &item : buckets[s])
+            results[item.pos] = _shards[s].rhamt.read_hashed(item.hash,
+                                                             *item.it);
+    });
+    for (const T * rv : results)
+        *out++ = rv;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+bool
+ShardedReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+empty() const
+{
+    for (size_t s = 0; s < _nshards; ++s) {
+        std::lock_guard<std::mutex> guard(_shards[s].lock);
+        if (!_shards[s].rhamt.empty())
+            return false;
+    }
+    return true;
+}
+
+
+template <class Key, class T, unsigned FT, class HashType, class Hash, class Pred,
+          class Alloc, template <class, size_t, unsigned> class Protect>
+size_t
+ShardedReliableHAMT<Key, T, FT, HashType, Hash, Pred, Alloc, Protect>::
+size() const
+{
+    size_t total = 0;
+    for (size_t s = 0; s < _nshards; ++s) {
+        std::lock_guard<std::mutex> guard(_shards[s].lock);
+        total += _shards[s].rhamt.size();
+    }
+    return total;
+}
+#endif // _SHARDED_HPP
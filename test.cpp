@@ -1,12 +1,32 @@
 #include "rhamt.hpp"
+#include "sharded.hpp"
+#include "frozen.hpp"
+#include "journal.hpp"
+#include "numa.hpp"
 #include <cassert>
 #include <iostream>
 #include <cstring>
 #include <cstdlib>
+#include <climits>
+#include <atomic>
 #include <cstdio>
 #include <unordered_map>
 #include <string>
 #include <chrono>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <iterator>
+#include <numeric>
+#include <random>
+#include <cmath>
+#include <algorithm>
+#ifdef __GLIBC__
+#include <malloc.h>
+#include <csignal>
+#include <sys/resource.h>
+#endif
+#include <unistd.h>
 #include <iostream>
 
 #define FAIL(msg)  {                                            \
@@ -43,6 +63,9 @@ bool unit_test(bool (*f)(void), std::string name,
         nanos dur = ttest->test();
         printf("\033[96;1;1m%s \033[32;1;4mfinished in %lu ns / per op\033[0m\n",
                 ttest->name.c_str(), dur.count() / ttest->numops);
+        // Hand freed tries back to the system, so that fragmentation left
+        // by one million-key test does not add to the next one's peak
+        malloc_trim(0);
     }
     return true;
 }
@@ -60,11 +83,11 @@ bool test_random_sparse()
         rhamt.insert(k, v);
     }
 
-    // if (rhamt.size() != golden.size()) {
-    //     printf("ERROR: %s %d: size mismatch (%lu != %lu)\n", __FILE__, __LINE__,
-    //                     rhamt.size(), golden.size());
-    //     return false;
-    // }
+    if (rhamt.size() != golden.size()) {
+        printf("ERROR: %s %d: size mismatch (%lu != %lu)\n", __FILE__, __LINE__,
+                        rhamt.size(), golden.size());
+        return false;
+    }
 
     for (auto it : golden) {
         const int *rv = rhamt.read(it.first);
@@ -77,61 +100,62 @@ bool test_random_sparse()
         rhamt.remove(it.first);
     }
 
-    // if (rhamt.size()) {
-    //     printf("ERROR: %s %d: expected size 0, instead size %lu\n",
-    //             __FILE__, __LINE__, rhamt.size());
-    //     return false;
-    // }
+    if (rhamt.size()) {
+        printf("ERROR: %s %d: expected size 0, instead size %lu\n",
+                __FILE__, __LINE__, rhamt.size());
+        return false;
+    }
 
     return true;
 
 }
-// 
-// bool test_small_rhamt()
-// {
-//     ReliableHAMT<int, int, FT, uint8_t> rhamt;
-// 
-//     // Fill it up, check that the size matches
-//     for (int i = 0; i < 256; i++) {
-//         rhamt.insert(i, i);
-//     }
-//     size_t size = rhamt.size();
-//     if (size != 256) {
-//         printf("ERROR: %s %d: size is %ld, expected %d\n", __FILE__, __LINE__, size, 256);
-//         return false;
-//     }
-// 
-//     // Remove a few keys
-//     for (int i = 0; i < 50; i++) {
-//         rhamt.remove(i);
-//     }
-//     size = rhamt.size();
-//     if (size != 206) {
-//         printf("ERROR: %s %d: size is %ld, expected %d\n", __FILE__, __LINE__, size, 206);
-//         return false;
-//     }
-// 
-//     // Insert keys bigger than the hash size, forcing collisions
-//     // Nodes 0-49 will contain single keys, while the rest hold two
-//     for (int i = 256; i < 512; i++) {
-//         rhamt.insert(i, i);
-//     }
-//     size = rhamt.size();
-//     if (size != 462) {
-//         printf("ERROR: %s %d: size is %ld, expected %d\n", __FILE__, __LINE__, size, 462);
-//         return false;
-//     }
-// 
-//     for (int i = 50; i < 512; ++i) {
-//         int val = *rhamt.read(i);
-//         if (i != val) {
-//             printf("ERROR: %s %d: read %d, expected %d\n", __FILE__, __LINE__, val, i);
-//             return false;
-//         }
-//     }
-// 
-//     return true;
-// }
+
+bool test_small_rhamt()
+{
+    ReliableHAMT<int, int, FT, uint8_t, std::hash<int>> rhamt;
+
+    // Fill it up, check that the size matches
+    for (int i = 0; i < 256; i++) {
+        rhamt.insert(i, i);
+    }
+    size_t size = rhamt.size();
+    if (size != 256) {
+        printf("ERROR: %s %d: size is %ld, expected %d\n", __FILE__, __LINE__, size, 256);
+        return false;
+    }
+
+    // Remove a few keys
+    for (int i = 0; i < 50; i++) {
+        rhamt.remove(i);
+    }
+    size = rhamt.size();
+    if (size != 206) {
+        printf("ERROR: %s %d: size is %ld, expected %d\n", __FILE__, __LINE__, size, 206);
+        return false;
+    }
+
+    // Insert keys bigger than the hash size, forcing collisions
+    // Nodes 0-49 will contain single keys, while the rest hold two
+    for (int i = 256; i < 512; i++) {
+        rhamt.insert(i, i);
+    }
+    size = rhamt.size();
+    if (size != 462) {
+        printf("ERROR: %s %d: size is %ld, expected %d\n", __FILE__, __LINE__, size, 462);
+        return false;
+    }
+
+    for (int i = 50; i < 512; ++i) {
+        int val = *rhamt.read(i);
+        if (i != val) {
+            printf("ERROR: %s %d: read %d, expected %d\n", __FILE__, __LINE__, val, i);
+            return false;
+        }
+    }
+
+    return true;
+}
+
 // 
 // bool test_overwrite()
 // {
@@ -200,143 +224,2253 @@ bool test_random_sparse()
 //     return true;
 // }
 // 
-// bool test_missing_read()
-// {
-//     ReliableHAMT<int, int, FT, uint8_t> hamt;
-// 
-//     hamt.insert(0, 0);
-//     const int * rv = hamt.read(256); // hash collision with key 0
-//     if (nullptr != rv) {
-//         FAIL("expected nullptr");
-//     }
-// 
-//     rv = hamt.read(1);
-//     if (nullptr != rv) {
-//         FAIL("expected nullptr");
-//     }
-// 
-//     rv = hamt.read(2);
-//     if (nullptr != rv) {
-//         FAIL("expected nullptr");
-//     }
-// 
-//     return true;
-// }
-// 
-// bool test_missing_remove()
-// {
-//     ReliableHAMT<int, int, FT, uint8_t> hamt;
-// 
-//     hamt.insert(0, 0);
-//     int rv = hamt.remove(512);  // remove non-existant key from existing leaf
-//     if (0 != rv) {
-//         FAIL("removed non-existant key");
-//     }
-//     if (1 != hamt.size()) {
-//         FAIL("lost stored value")
-//     }
-// 
-//     rv = hamt.remove(1);  // remove key from non-existant node
-//     if (0 != rv) {
-//         FAIL("removed non-existant key");
-//     }
-//     if (1 != hamt.size()) {
-//         FAIL("lost stored value");
-//     }
-// 
-//     if (0 != *hamt.read(0)) {
-//         FAIL("incorrect read value");
-//     }
-// 
-//     return true;
-// }
+bool test_missing_read()
+{
+    ReliableHAMT<int, int, FT, uint8_t, std::hash<int>> hamt;
 
+    hamt.insert(0, 0);
+    const int * rv = hamt.read(257); // hash collision with key 0
+    if (nullptr != rv) {
+        FAIL("expected nullptr");
+    }
 
- nanos test_timing_access_built()
+    rv = hamt.read(1);
+    if (nullptr != rv) {
+        FAIL("expected nullptr");
+    }
+
+    rv = hamt.read(2);
+    if (nullptr != rv) {
+        FAIL("expected nullptr");
+    }
+
+    return true;
+}
+
+bool test_missing_remove()
 {
-    // Get Duration of 1,000,000 accesses to an already built Trie
+    ReliableHAMT<int, int, FT, uint8_t, std::hash<int>> hamt;
+
+    hamt.insert(0, 0);
+    int rv = hamt.remove(514);  // remove non-existant key from existing leaf
+    if (0 != rv) {
+        FAIL("removed non-existant key");
+    }
+    if (1 != hamt.size()) {
+        FAIL("lost stored value");
+    }
+
+    rv = hamt.remove(1);  // remove key from non-existant node
+    if (0 != rv) {
+        FAIL("removed non-existant key");
+    }
+    if (1 != hamt.size()) {
+        FAIL("lost stored value");
+    }
+
+    if (0 != *hamt.read(0)) {
+        FAIL("incorrect read value");
+    }
+
+    return true;
+}
+
+
+bool test_remove_reclaims()
+{
+    EpochReclaimer& reclaimer = EpochReclaimer::instance();
     ReliableHAMT<int, int, FT> rhamt;
-    static constexpr int s = 1000000;
-    for (int i = 0; i < s; ++i) {
-        rhamt.insert(s, s);
+
+    while (reclaimer.pending())
+        reclaimer.collect();
+    for (int i = 0; i < 1000; ++i)
+        rhamt.insert(i, i);
+    for (int i = 0; i < 1000; i += 2)
+        rhamt.remove(i);
+
+    // Freed leaves are retired, not deleted in place
+    size_t retired = reclaimer.pending();
+    if (0 == retired) {
+        FAIL("no nodes were retired");
+    }
+    for (int i = 1; i < 1000; i += 2) {
+        const int *rv = rhamt.read(i);
+        if (nullptr == rv || *rv != i) {
+            FAIL("lost a key that was not removed");
+        }
+    }
+    for (int i = 0; i < 1000; i += 2) {
+        if (nullptr != rhamt.read(i)) {
+            FAIL("removed key is still readable");
+        }
     }
 
-    auto lstime = std::chrono::high_resolution_clock::now();
-    for (volatile int i = 0; i < s; ++i) ;
-    auto letime = std::chrono::high_resolution_clock::now();
-    auto ldur = letime - lstime;
-    // printf("loop duration: %lu nanos / iteration\n", ldur.count() / s);
-    // Loop duration is ~ 1 ns / iter
-    
-    auto stime = std::chrono::high_resolution_clock::now();
-    for (int i = 0; i < s; ++i) {
-        volatile int k = *rhamt.read(s);
-        (void)k;
+    // Nothing is pinned, so two epoch advances free everything
+    reclaimer.collect();
+    reclaimer.collect();
+    if (reclaimer.pending()) {
+        FAIL("retired nodes were not freed once unpinned");
     }
-    auto etime = std::chrono::high_resolution_clock::now();
 
-    auto dur = etime - stime;
-    return dur - ldur;;
+    return true;
 }
 
-nanos test_timing_build_trie_random()
+/* One writer overwrites and removes keys while readers look them up. Every
+ * value names its key (`owner`), so a reader that gets anything else has
+ * read a torn or freed entry; keys divisible by 7 are never removed, so they
+ * must always be found.
+ */
+template <class RHAMT, class Make, class Owner>
+bool reads_alongside_writer(RHAMT& rhamt, Make make, Owner owner)
+{
+    static constexpr int nkeys = 256;
+    for (int k = 0; k < nkeys; ++k)
+        rhamt.insert(k, make(k, 0));
+
+    std::atomic<bool> done(false);
+    std::atomic<int> bad(0), lost(0);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 3; ++t) {
+        readers.emplace_back([&, t] {
+            std::mt19937 rng(t);
+            while (!done.load(std::memory_order_relaxed)) {
+                const int k = rng() % nkeys;
+                auto v = rhamt.get(k);
+                if (v && owner(*v) != k)
+                    ++bad;
+                else if (!v && 0 == k % 7)
+                    ++lost;
+            }
+        });
+    }
+    static constexpr int rounds = 200;
+    auto removed = [](int k, int round)
+        { return 0 != k % 7 && 0 == (k + round) % 3; };
+    for (int round = 1; round < rounds; ++round) {
+        for (int k = 0; k < nkeys; ++k) {
+            if (removed(k, round))
+                rhamt.remove(k);
+            else
+                rhamt.insert(k, make(k, round));
+        }
+    }
+    done = true;
+    for (auto &th : readers)
+        th.join();
+    if (bad) {
+        FAIL("a concurrent read returned another key's value");
+    }
+    if (lost) {
+        FAIL("a concurrent read missed a key that was never removed");
+    }
+    for (int k = 0; k < nkeys; ++k) {
+        auto v = rhamt.get(k);
+        if (removed(k, rounds - 1) ? v.has_value()
+                                   : (!v || *v != make(k, rounds - 1))) {
+            FAIL("wrong value once the writer was done");
+        }
+    }
+    return true;
+}
+
+bool test_concurrent_reads()
+{
+    // Leaf chains of 256 keys on an 8-bit hash, with values that are not
+    // written in one store
+    ReliableHAMT<int, std::string, FT, uint8_t> chains;
+    auto text = [](int k, int round) {
+        return std::to_string(k) + "/" + std::string(20 + round % 50, 'x');
+    };
+    auto text_owner = [](const std::string& v) {
+        return std::stoi(v.substr(0, v.find('/')));
+    };
+    // Inline entries in Reed-Solomon coded slots, and plain leaves
+    ReliableHAMT<uint16_t, uint16_t, FT, uint32_t, MixHash<uint16_t>,
+                 std::equal_to<uint16_t>,
+                 std::allocator<std::pair<const uint16_t, uint16_t>>,
+                 ReedSolomonSlots> coded;
+    auto word = [](int k, int round) { return uint16_t(k | (round << 8)); };
+    auto word_owner = [](uint16_t v) { return int(v & 0xFF); };
+    ReliableHAMT<int, int, FT> plain;
+    auto number = [](int k, int round) { return k + 256 * round; };
+    auto number_owner = [](int v) { return v % 256; };
+
+    return reads_alongside_writer(chains, text, text_owner) &&
+           reads_alongside_writer(coded, word, word_owner) &&
+           reads_alongside_writer(plain, number, number_owner);
+}
+
+bool test_reed_solomon_slots()
+{
+    // Two corrupted words in one array are corrected at FT=2
+    ReedSolomonSlots<int *, 32, 2> slots;
+    static int target[32];
+    for (int i = 0; i < 32; ++i)
+        slots.set(i, &target[i]);
+
+    slots.raw(3, 0) = reinterpret_cast<int *>(0xdeadbeef);
+    slots.raw(31, 0) = nullptr;
+    for (int i = 0; i < 32; ++i) {
+        if (slots.vote(i) != &target[i]) {
+            FAIL("corrupted slot was not corrected");
+        }
+    }
+
+    // Three corrupted words are beyond FT=2 and must not be silently used
+    slots.raw(0, 0) = nullptr;
+    slots.raw(1, 0) = nullptr;
+    slots.raw(2, 0) = nullptr;
+    try {
+        slots.vote(0);
+    }
+    catch (const std::runtime_error& e) {
+        return true;
+    }
+    FAIL("uncorrectable array was not detected");
+}
+
+bool test_reed_solomon_rhamt()
+{
+    ReliableHAMT<int, int, FT, uint32_t, std::hash<int>, std::equal_to<int>,
+                 std::allocator<std::pair<const int, int>>,
+                 ReedSolomonSlots> rhamt;
+    std::unordered_map<int, int> golden;
+
+    for (int i = 0; i < 100000; ++i) {
+        int k = rand();
+        golden[k] = i;
+        rhamt.insert(k, i);
+    }
+    for (auto it : golden) {
+        const int *rv = rhamt.read(it.first);
+        if (nullptr == rv || *rv != it.second) {
+            FAIL("unexpected value");
+        }
+    }
+    for (auto it : golden)
+        rhamt.remove(it.first);
+    if (!rhamt.empty()) {
+        FAIL("expected empty trie");
+    }
+
+    return true;
+}
+
+template <class RHAMT>
+bool inline_entries_match(RHAMT& rhamt)
+{
+    std::unordered_map<uint16_t, uint16_t> golden;
+
+    for (int i = 0; i < 200000; ++i) {
+        uint16_t k = rand(), v = rand();
+        if (rand() % 4 == 0) {
+            if (rhamt.remove(k) != (int)golden.erase(k)) {
+                FAIL("remove result mismatch");
+            }
+        }
+        else {
+            golden[k] = v;
+            const uint16_t *rv = rhamt.insert(k, v);
+            if (nullptr == rv || *rv != v) {
+                FAIL("insert returned a bad pointer");
+            }
+        }
+    }
+    if (rhamt.size() != golden.size()) {
+        FAIL("size mismatch");
+    }
+    for (auto it : golden) {
+        const uint16_t *rv = rhamt.read(it.first);
+        if (nullptr == rv || *rv != it.second) {
+            FAIL("unexpected value");
+        }
+    }
+    for (auto it : golden)
+        rhamt.remove(it.first);
+    if (!rhamt.empty()) {
+        FAIL("expected empty trie");
+    }
+
+    return true;
+}
+
+bool test_inline_entries()
+{
+    // uint16_t pairs are stored in the child slots. An 8-bit hash forces
+    // 256-way collisions, so most slots are turned into real leaves.
+    ReliableHAMT<uint16_t, uint16_t, FT> rhamt;
+    ReliableHAMT<uint16_t, uint16_t, FT, uint8_t> colliding;
+    ReliableHAMT<uint16_t, uint16_t, FT, uint32_t, MixHash<uint16_t>,
+                 std::equal_to<uint16_t>,
+                 std::allocator<std::pair<const uint16_t, uint16_t>>,
+                 ReedSolomonSlots> coded;
+
+    return inline_entries_match(rhamt) && inline_entries_match(colliding) &&
+           inline_entries_match(coded);
+}
+
+template <class RHAMT>
+bool rhamt_matches(RHAMT& rhamt, const std::unordered_map<int, int>& golden)
+{
+    if (rhamt.size() != golden.size()) {
+        FAIL("size mismatch");
+    }
+    for (auto it : golden) {
+        const int *rv = rhamt.read(it.first);
+        if (nullptr == rv || *rv != it.second) {
+            FAIL("unexpected value");
+        }
+    }
+    return true;
+}
+
+template <class Journal>
+bool journal_matches(Journal& journal,
+                     const std::unordered_map<int, int>& golden)
+{
+    if (journal.size() != golden.size()) {
+        FAIL("size mismatch");
+    }
+    for (auto it : golden) {
+        const std::optional<int> rv = journal.read(it.first);
+        if (!rv || *rv != it.second) {
+            FAIL("unexpected value");
+        }
+    }
+    return true;
+}
+
+bool test_root_table()
 {
+    std::unordered_map<int, int> golden;
     ReliableHAMT<int, int, FT> rhamt;
-    static constexpr int s = 1000000;
-    volatile int k;
 
-    auto lstime = std::chrono::high_resolution_clock::now();
-    for (int i = 0; i < s; ++i) {
-        k = rand();
-        // rhamt.insert(s, s);
+    for (int i = 0; i < 100000; ++i) {
+        int k = rand();
+        golden[k] = i;
+        rhamt.insert(k, i);
     }
-    (void)k;
-    auto letime = std::chrono::high_resolution_clock::now();
-    auto ldur = letime - lstime;
+    rhamt.set_root_bits(15);
+    if (!rhamt_matches(rhamt, golden))
+        return false;
 
-    auto stime = std::chrono::high_resolution_clock::now();
-    for (int i = 0; i < s; ++i) {
-        rhamt.insert(rand(), s);
+    // Mixed operations through the table, then resize it both ways
+    for (int i = 0; i < 100000; ++i) {
+        int k = rand();
+        if (i % 3 == 0) {
+            if (rhamt.remove(k) != (int)golden.erase(k)) {
+                FAIL("remove result mismatch");
+            }
+        }
+        else {
+            golden[k] = i;
+            rhamt.insert(k, i);
+        }
     }
-    auto etime = std::chrono::high_resolution_clock::now();
-    auto dur = etime - stime;
-    return dur - ldur;
+    for (unsigned bits : { 20u, 10u, 0u, 15u }) {
+        rhamt.set_root_bits(bits);
+        if (!rhamt_matches(rhamt, golden))
+            return false;
+    }
+    rhamt.scrub();
+
+    // Bulk loading into a table
+    std::vector<std::pair<int, int>> input;
+    for (int i = 0; i < 100000; ++i) {
+        input.emplace_back(rand(), i);
+        golden[input.back().first] = i;
+    }
+    rhamt.build(input.begin(), input.end(), 4);
+    rhamt.set_negative_filter(10 * golden.size());
+    if (!rhamt_matches(rhamt, golden))
+        return false;
+    for (auto it : golden)
+        rhamt.remove(it.first);
+    if (!rhamt.empty()) {
+        FAIL("expected empty trie");
+    }
+
+    try {
+        rhamt.set_root_bits(12);
+        FAIL("accepted a width that is not a multiple of 5");
+    }
+    catch (const std::invalid_argument& e) { }
+
+    return true;
 }
 
-nanos test_timing_build_trie_sequential()
+template <class RHAMT, class K, class V>
+bool frozen_matches(RHAMT& rhamt, const std::unordered_map<K, V>& golden,
+                    const std::vector<K>& absent)
+{
+    auto frozen = rhamt.freeze();
+    if (frozen.size() != golden.size()) {
+        FAIL("frozen size mismatch");
+    }
+    frozen.scrub();
+    for (auto it : golden) {
+        const V *rv = frozen.read(it.first);
+        if (nullptr == rv || *rv != it.second) {
+            FAIL("unexpected frozen value");
+        }
+    }
+    for (K k : absent) {
+        if (!golden.count(k) && nullptr != frozen.read(k)) {
+            FAIL("read an absent key from the frozen trie");
+        }
+    }
+
+    auto thawed = frozen.thaw();
+    if (thawed.size() != golden.size()) {
+        FAIL("thawed size mismatch");
+    }
+    for (auto it : golden) {
+        const V *rv = thawed.read(it.first);
+        if (nullptr == rv || *rv != it.second) {
+            FAIL("unexpected thawed value");
+        }
+    }
+    return true;
+}
+
+bool test_freeze()
 {
+    std::unordered_map<int, int> golden;
+    std::vector<int> absent;
     ReliableHAMT<int, int, FT> rhamt;
-    static constexpr int s = 1000000;
-    volatile int k;
+    ReliableHAMT<int, int, FT, uint8_t> colliding;
+    for (int i = 0; i < 100000; ++i) {
+        int k = rand();
+        golden[k] = i;
+        rhamt.insert(k, i);
+        absent.push_back(rand());
+    }
+    for (auto it : golden)
+        if (it.first % 16 == 0)
+            colliding.insert(it.first, it.second);
+    if (!frozen_matches(rhamt, golden, absent))
+        return false;
+    rhamt.set_root_bits(15);
+    if (!frozen_matches(rhamt, golden, absent))
+        return false;
 
-    auto lstime = std::chrono::high_resolution_clock::now();
-    for (int i = 0; i < s; ++i) k = i;
-    (void)k;
-    auto letime = std::chrono::high_resolution_clock::now();
-    auto ldur = letime - lstime;
+    std::unordered_map<int, int> sparse;
+    for (auto it : golden)
+        if (it.first % 16 == 0)
+            sparse.insert(it);
+    if (!frozen_matches(colliding, sparse, absent))
+        return false;
 
-    auto stime = std::chrono::high_resolution_clock::now();
-    for (int i = 0; i < s; ++i) {
-        rhamt.insert(s, s);
+    // Inline entries
+    std::unordered_map<uint16_t, uint16_t> small;
+    std::vector<uint16_t> small_absent;
+    ReliableHAMT<uint16_t, uint16_t, FT> inlined;
+    for (int i = 0; i < 20000; ++i) {
+        uint16_t k = rand();
+        small[k] = i;
+        inlined.insert(k, i);
+        small_absent.push_back(rand());
     }
-    auto etime = std::chrono::high_resolution_clock::now();
-    auto dur = etime - stime;
-    return dur - ldur;
+    if (!frozen_matches(inlined, small, small_absent))
+        return false;
+
+    ReliableHAMT<int, int, FT> none;
+    return frozen_matches(none, std::unordered_map<int, int>(), absent);
 }
 
-int main(void)
+// Value type counting its live instances, to see leaves being freed
+struct Counted {
+    static inline std::atomic<long> live{0};
+    int v;
+    Counted(int v = 0) : v(v) { ++live; }
+    Counted(const Counted& o) : v(o.v) { ++live; }
+    Counted& operator=(const Counted&) = default;
+    bool operator==(const Counted& o) const { return v == o.v; }
+    ~Counted() { --live; }
+};
+
+bool test_snapshot()
 {
-    printf("Beginning Testing...\n");
-    srand(time(NULL));
-    TimingTest ttest;
+    std::unordered_map<int, int> golden;
+    ReliableHAMT<int, int, FT> rhamt;
+    for (int i = 0; i < 100000; ++i) {
+        int k = rand();
+        golden[k] = i;
+        rhamt.insert(k, i);
+    }
 
-    // unit_test(test_small_rhamt, "test_small_rhamt");
-    // unit_test(test_random_sparse, "test_random_sparse");
+    // Overwrite, remove and add keys while another thread reads the snapshot
+    auto snap = rhamt.snapshot();
+    const std::unordered_map<int, int> before = golden;
+    std::atomic<bool> done(false), isolated(true);
+    std::thread reader([&]() {
+        while (!done && isolated) {
+            for (auto it : before) {
+                const int *rv = snap.read(it.first);
+                if (nullptr == rv || *rv != it.second)
+                    isolated = false;
+            }
+        }
+    });
+    int n = 0;
+    for (auto it : before) {
+        switch (n++ % 3) {
+            case 0:
+                golden[it.first] = -it.second;
+                rhamt.insert(it.first, -it.second);
+                break;
+            case 1:
+                golden.erase(it.first);
+                rhamt.remove(it.first);
+                break;
+            default:
+                int k = rand();
+                golden[k] = n;
+                rhamt.insert(k, n);
+        }
+    }
+    done = true;
+    reader.join();
+    if (!isolated) {
+        FAIL("snapshot changed under a concurrent writer");
+    }
+    if (!rhamt_matches(rhamt, golden) || !rhamt_matches(snap, before))
+        return false;
+
+    // Snapshots of a root table, thawed and written on their own
+    rhamt.set_root_bits(15);
+    auto tsnap = rhamt.snapshot();
+    auto thawed = tsnap.thaw();
+    for (auto it : before) {
+        thawed.remove(it.first);
+        rhamt.insert(it.first, 0);
+    }
+    if (!rhamt_matches(tsnap, golden)) {
+        FAIL("table snapshot changed");
+    }
+    for (auto it : before) {
+        if (nullptr != thawed.read(it.first)) {
+            FAIL("thawed trie did not take a remove");
+        }
+    }
+    ReliableHAMT<int, int, FT> copy;
+    copy = rhamt;
+    copy.insert(0, 1);
+    copy.set_root_bits(0);
+    for (auto it : before) {
+        const int *rv = rhamt.read(it.first);
+        if (nullptr == rv || *rv != 0) {
+            FAIL("write to a copy reached the original");
+        }
+    }
+
+    // Nodes only a snapshot still references go with the snapshot
+    EpochReclaimer& reclaimer = EpochReclaimer::instance();
+    auto settle = [&]() {
+        for (int i = 0; i < 3; ++i)
+            reclaimer.collect();
+    };
+    {
+        ReliableHAMT<int, Counted, FT> counted;
+        for (int i = 0; i < 1000; ++i)
+            counted.insert(i, Counted(i));
+        {
+            auto held = counted.snapshot();
+            for (int i = 0; i < 1000; i += 2)
+                counted.remove(i);
+            settle();
+            if (1000 != Counted::live || 1000 != held.size()) {
+                FAIL("removed entries left the snapshot");
+            }
+        }
+        settle();
+        if (500 != Counted::live) {
+            FAIL("entries only the snapshot held were not freed");
+        }
+    }
+    settle();
+    if (0 != Counted::live) {
+        FAIL("entries leaked after every version was dropped");
+    }
+    return true;
+}
+
+bool test_change_log()
+{
+    std::unordered_map<int, int> golden;
+    ReliableHAMT<int, int, FT> leader, follower;
+    leader.set_change_log(1 << 16);
+    uint64_t next = 0;
+
+    // Mixed writes, shipped to the follower after every round
+    std::string delta;
+    for (int round = 0; round < 10; ++round) {
+        for (int i = 0; i < 5000; ++i) {
+            int k = rand() % 20000;
+            if (i % 4 == 0) {
+                leader.remove(k);
+                golden.erase(k);
+            }
+            else {
+                leader.insert(k, i);
+                golden[k] = i;
+            }
+        }
+        delta.clear();
+        leader.drain_changes(delta);
+        next = follower.apply_delta(delta, next, 2);
+        if (next != leader.change_seq()) {
+            FAIL("follower is not caught up");
+        }
+        if (!rhamt_matches(follower, golden))
+            return false;
+    }
+    // Redelivery is a no-op
+    if (follower.apply_delta(delta, next) != next ||
+            !rhamt_matches(follower, golden)) {
+        FAIL("redelivered delta was applied twice");
+    }
+
+    // Bulk loads are logged too, and deltas stream through a pipe
+    std::vector<std::pair<int, int>> input;
+    for (int i = 0; i < 20000; ++i) {
+        input.emplace_back(rand(), i);
+        golden[input.back().first] = i;
+    }
+    int fds[2];
+    if (0 != pipe(fds)) {
+        FAIL("pipe");
+    }
+    std::thread shipper([&]() {
+        leader.build(input.begin(), input.end(), 4);
+        for (int i = 0; i < 1000; ++i) {
+            leader.remove(input[i].first);
+            std::string out;
+            leader.drain_changes(out);
+            for (size_t off = 0; off < out.size(); ) {
+                ssize_t w = write(fds[1], out.data() + off, out.size() - off);
+                if (w <= 0)
+                    break;
+                off += w;
+            }
+        }
+        close(fds[1]);
+    });
+    std::string stream;
+    char buf[1 << 16];
+    for (ssize_t r; (r = read(fds[0], buf, sizeof(buf))) > 0; )
+        stream.append(buf, r);
+    shipper.join();
+    close(fds[0]);
+    for (int i = 0; i < 1000; ++i)
+        golden.erase(input[i].first);
+    next = follower.apply_delta(stream, next, 4);
+    if (!rhamt_matches(follower, golden))
+        return false;
+
+    // A corrupt delta or a gap is rejected without applying anything
+    leader.insert(1, 1);
+    delta.clear();
+    leader.drain_changes(delta);
+    delta[delta.size() - 1] ^= 1;
+    try {
+        follower.apply_delta(delta, next);
+        FAIL("applied a corrupt delta");
+    }
+    catch (const std::runtime_error& e) { }
+    leader.set_change_log(100);
+    for (int i = 0; i < 1000; ++i)
+        leader.insert(i, i);
+    delta.clear();
+    if (100 != leader.drain_changes(delta)) {
+        FAIL("log kept more than its capacity");
+    }
+    try {
+        follower.apply_delta(delta, next);
+        FAIL("applied a delta with missing changes");
+    }
+    catch (const std::runtime_error& e) { }
+    return rhamt_matches(follower, golden);
+}
+
+bool test_journal()
+{
+    const std::string path = "/tmp/rhamt_test_journal.log";
+    unlink(path.c_str());
+    std::unordered_map<int, int> golden;
+    for (int i = 0; i < 2000; ++i)
+        for (int t = 0; t < 4; ++t)
+            if (i % 5 != 0)
+                golden[i * 4 + t] = i;
+
+    // Concurrent writers sharing group commits
+    {
+        JournaledReliableHAMT<int, int, FT> journal(path, 64,
+                                            std::chrono::microseconds(200));
+        std::vector<std::thread> pool;
+        for (int t = 0; t < 4; ++t) {
+            pool.emplace_back([&journal, t]() {
+                for (int i = 0; i < 2000; ++i) {
+                    journal.insert(i * 4 + t, i);
+                    if (i % 5 == 0)
+                        journal.remove(i * 4 + t);
+                }
+            });
+        }
+        // Reads run alongside, and only ever see a value written for a key
+        std::atomic<bool> bad_read{false};
+        std::thread reader([&journal, &bad_read]() {
+            for (int n = 0; n < 20000; ++n) {
+                const int k = n % 8000;
+                const std::optional<int> v = journal.read(k);
+                if (v && *v != k / 4)
+                    bad_read = true;
+            }
+        });
+        for (auto &th : pool)
+            th.join();
+        reader.join();
+        if (bad_read) {
+            FAIL("read a value that was never written");
+        }
+        if (journal.syncs() >= 8000) {
+            FAIL("group commit did not batch any syncs");
+        }
+    }
+    {
+        JournaledReliableHAMT<int, int, FT> journal(path, 4096,
+                                std::chrono::microseconds(1000), 4);
+        if (!journal_matches(journal, golden))
+            return false;
+    }
+
+    // A torn tail is cut off, and later changes follow what was kept
+    FILE *f = fopen(path.c_str(), "ab");
+    const char torn[] = "RHD1 torn write";
+    fwrite(torn, 1, sizeof(torn), f);
+    fclose(f);
+    {
+        JournaledReliableHAMT<int, int, FT> journal(path, 16,
+                                            std::chrono::microseconds(0));
+        if (!journal_matches(journal, golden))
+            return false;
+        for (int i = 0; i < 100; ++i) {
+            journal.insert(-i, i);
+            golden[-i] = i;
+        }
+        journal.remove(4);
+        golden.erase(4);
+    }
+    {
+        JournaledReliableHAMT<int, int, FT> journal(path);
+        if (!journal_matches(journal, golden))
+            return false;
+    }
+    unlink(path.c_str());
+    return true;
+}
+
+bool test_journal_failure()
+{
+    /* Cap the file size so the journal runs out of room: the failed write
+     * must not be followed by more writes, and later mutations must throw
+     * without being applied, in both commit modes. */
+    const std::string path = "/tmp/rhamt_test_journal_failure.log";
+    for (int interval : {0, 200}) {
+        unlink(path.c_str());
+        std::unordered_map<int, int> golden;
+        int failed = -1;
+        signal(SIGXFSZ, SIG_IGN);
+        struct rlimit old_limit;
+        getrlimit(RLIMIT_FSIZE, &old_limit);
+        {
+            JournaledReliableHAMT<int, int, FT> journal(path, 16,
+                                    std::chrono::microseconds(interval));
+            for (int i = 0; i < 100; ++i) {
+                journal.insert(i, i);
+                golden[i] = i;
+            }
+            FILE *f = fopen(path.c_str(), "rb");
+            fseek(f, 0, SEEK_END);
+            struct rlimit limit = old_limit;
+            limit.rlim_cur = ftell(f) + 4096;
+            fclose(f);
+            setrlimit(RLIMIT_FSIZE, &limit);
+            for (int i = 100; i < 100000 && failed < 0; ++i) {
+                try {
+                    journal.insert(i, i);
+                    golden[i] = i;
+                }
+                catch (const std::system_error& e) {
+                    failed = i;
+                }
+            }
+            if (failed < 0) {
+                setrlimit(RLIMIT_FSIZE, &old_limit);
+                FAIL("journal write did not fail past the size limit");
+            }
+            setrlimit(RLIMIT_FSIZE, &old_limit);
+
+            // The journal stays failed, and nothing more reaches the trie
+            const size_t size = journal.size();
+            try {
+                journal.insert(-1, 1);
+                FAIL("insert succeeded after a failed write");
+            }
+            catch (const std::system_error& e) { }
+            try {
+                journal.remove(0);
+                FAIL("remove succeeded after a failed write");
+            }
+            catch (const std::system_error& e) { }
+            if (journal.read(-1) || !journal.read(0) || journal.size() != size) {
+                FAIL("mutation applied after a failed write");
+            }
+        }
+
+        // Every acknowledged change survives, nothing after the failure does
+        {
+            JournaledReliableHAMT<int, int, FT> journal(path);
+            for (const auto& kv : golden) {
+                const std::optional<int> val = journal.read(kv.first);
+                if (!val || *val != kv.second) {
+                    FAIL("acknowledged change lost");
+                }
+            }
+            if (journal.read(-1) || journal.size() > golden.size() + 16) {
+                FAIL("journal written after a failed write");
+            }
+        }
+    }
+    unlink(path.c_str());
+    return true;
+}
+
+bool test_numa_slots()
+{
+    using NumaRHAMT = ReliableHAMT<int, int, FT, uint32_t, MixHash<int>,
+                                   std::equal_to<int>,
+                                   std::allocator<std::pair<const int, int>>,
+                                   NumaSlots>;
+    std::unordered_map<int, int> golden;
+    NumaRHAMT rhamt;
+
+    for (int i = 0; i < 20000; ++i) {
+        int k = rand();
+        if (i % 4 == 0) {
+            if (rhamt.remove(k) != (int)golden.erase(k)) {
+                FAIL("remove result mismatch");
+            }
+        }
+        else {
+            golden[k] = i;
+            rhamt.insert(k, i);
+        }
+    }
+    if (!rhamt_matches(rhamt, golden))
+        return false;
+
+    // Rows are copied by snapshots' path copies and by root table changes
+    auto before = golden;
+    auto snap = rhamt.snapshot();
+    for (int i = 0; i < 2000; ++i) {
+        int k = rand();
+        golden[k] = i;
+        rhamt.insert(k, i);
+    }
+    for (unsigned bits : { 15u, 0u }) {
+        rhamt.set_root_bits(bits);
+        if (!rhamt_matches(rhamt, golden) || !rhamt_matches(snap, before))
+            return false;
+    }
+    rhamt.scrub();
+
+    auto stats = rhamt.inspect();
+    if (stats.entries != golden.size() || stats.count_mismatches != 0) {
+        FAIL("inspect mismatch");
+    }
+
+    // Rows built on worker threads are freed here, after their stashes
+    // have gone back to the pools
+    std::vector<NumaRHAMT> built(4);
+    std::vector<std::thread> pool;
+    for (int t = 0; t < 4; ++t) {
+        pool.emplace_back([&built, t]() {
+            for (int i = 0; i < 5000; ++i)
+                built[t].insert(i * 4 + t, i);
+        });
+    }
+    for (auto &th : pool)
+        th.join();
+    for (int t = 0; t < 4; ++t) {
+        std::unordered_map<int, int> part;
+        for (int i = 0; i < 5000; ++i)
+            part[i * 4 + t] = i;
+        if (!rhamt_matches(built[t], part))
+            return false;
+    }
+    built.clear();
+    return rhamt_matches(rhamt, golden);
+}
+
+bool test_inspect()
+{
+    ReliableHAMT<int, int, FT> rhamt;
+    std::unordered_map<int, int> golden;
+    for (int i = 0; i < 100000; ++i) {
+        int k = rand();
+        golden[k] = i;
+        rhamt.insert(k, i);
+    }
+
+    auto stats = rhamt.inspect();
+    if (stats.entries != golden.size() || stats.count_mismatches != 0) {
+        FAIL("wrong entry count");
+    }
+    if (stats.split_nodes[0] != 1 || stats.inline_entries != 0) {
+        FAIL("unexpected shape");
+    }
+    size_t nodes = 0, occupied = 0, keys = 0, leaves = 0;
+    for (size_t n : stats.split_nodes)
+        nodes += n;
+    for (size_t k = 0; k < stats.occupancy.size(); ++k) {
+        nodes -= stats.occupancy[k];
+        occupied += k * stats.occupancy[k];
+    }
+    for (size_t n = 0; n < stats.chains.size(); ++n) {
+        keys += n * stats.chains[n];
+        leaves += stats.chains[n];
+    }
+    if (nodes != 0 || keys != stats.entries || leaves != stats.leaves) {
+        FAIL("histograms do not add up");
+    }
+    // Every occupied slot holds a split node below the root, or a leaf
+    if (occupied + 1 != stats.leaves + std::accumulate(
+            stats.split_nodes.begin(), stats.split_nodes.end(), size_t(0))) {
+        FAIL("occupied slots do not match nodes");
+    }
+    if (stats.payload_bytes != stats.entries * 2 * sizeof(int) ||
+            (FT > 0) != (stats.replica_bytes > 0) ||
+            stats.bytes_per_key() <= 2 * sizeof(int)) {
+        FAIL("unexpected byte counts");
+    }
+
+    // The same contents under a root table
+    rhamt.set_root_bits(15);
+    auto table = rhamt.inspect();
+    if (table.entries != stats.entries || table.count_mismatches != 0 ||
+            table.leaves != stats.leaves || table.chains != stats.chains) {
+        FAIL("root table changed the contents");
+    }
+
+    // An 8-bit hash makes long collision chains...
+    ReliableHAMT<int, int, FT, uint8_t> colliding;
+    for (int i = 0; i < 2560; ++i)
+        colliding.insert(i, i);
+    auto chains = colliding.inspect();
+    if (chains.leaves != 256 || chains.chains.size() < 11) {
+        FAIL("collisions not reported");
+    }
+
+    // ...and small entries live in the slots themselves
+    ReliableHAMT<uint16_t, uint16_t, FT> small;
+    for (int i = 0; i < 1000; ++i)
+        small.insert(i, i);
+    auto slots = small.inspect();
+    if (slots.inline_entries != 1000 || slots.leaves != 0 ||
+            slots.payload_bytes != 4000) {
+        FAIL("inline entries not reported");
+    }
+    return true;
+}
+
+bool test_negative_filter()
+{
+    ReliableHAMT<int, int, FT> rhamt;
+
+    for (int i = 0; i < 10000; ++i)
+        rhamt.insert(2 * i, i);
+    rhamt.set_negative_filter(10 * 10000);
+    for (int i = 10000; i < 11000; ++i)
+        rhamt.insert(2 * i, i);
+
+    for (int i = 0; i < 11000; ++i) {
+        const int *rv = rhamt.read(2 * i);
+        if (nullptr == rv || *rv != i) {
+            FAIL("filter hid a stored key");
+        }
+    }
+    for (int i = 0; i < 11000; ++i) {
+        if (nullptr != rhamt.read(2 * i + 1)) {
+            FAIL("read an absent key");
+        }
+        if (0 != rhamt.remove(2 * i + 1)) {
+            FAIL("removed an absent key");
+        }
+    }
+    if (rhamt.size() != 11000) {
+        FAIL("misses changed the size");
+    }
+
+    return true;
+}
+
+/* Keys that are consecutive, in runs of 64 spaced 2^20 apart, or random */
+std::vector<int> hash_key_set(const int kind, const int n)
+{
+    std::vector<int> keys;
+    for (int i = 0; i < n; ++i) {
+        if (0 == kind)
+            keys.push_back(i);
+        else if (1 == kind)
+            keys.push_back(((i / 64) << 20) + i % 64);
+        else
+            keys.push_back(rand());
+    }
+    return keys;
+}
+
+/* Chi-square statistic of the keys' hashes over 1024 buckets, taken from
+ * either the low bits (the first two trie levels) or the high bits (the
+ * last levels and the shard index).
+ */
+template <class Hash>
+double hash_chi_square(const std::vector<int>& keys, const bool high)
+{
+    static constexpr int nbuckets = 1024;
+    std::vector<size_t> buckets(nbuckets, 0);
+    Hash hasher;
+    for (int k : keys) {
+        uint32_t h = fold_hash<uint32_t>(hasher(k));
+        ++buckets[high ? h >> 22 : h & (nbuckets - 1)];
+    }
+    const double expected = double(keys.size()) / nbuckets;
+    double chi = 0;
+    for (size_t b : buckets)
+        chi += (b - expected) * (b - expected) / expected;
+    return chi;
+}
+
+bool test_hash_distribution()
+{
+    // 1023 degrees of freedom: mean 1023, standard deviation ~45
+    static constexpr double bound = 1023 + 8 * 45;
+    static const char * names[] = { "sequential", "clustered", "random" };
+
+    for (int kind = 0; kind < 3; ++kind) {
+        std::vector<int> keys = hash_key_set(kind, 1 << 16);
+        double lo = hash_chi_square<MixHash<int>>(keys, false);
+        double hi = hash_chi_square<MixHash<int>>(keys, true);
+        printf("  %-10s  MixHash chi2 low %8.0f high %8.0f", names[kind],
+                lo, hi);
+        printf("  std::hash chi2 low %8.0f high %8.0f\n",
+                hash_chi_square<std::hash<int>>(keys, false),
+                hash_chi_square<std::hash<int>>(keys, true));
+        if (lo > bound || hi > bound) {
+            FAIL("MixHash is not uniform");
+        }
+    }
+
+    std::string a = "reliable", b = "reliablf";
+    MixHash<std::string> shash;
+    if (shash(a) == shash(b) || shash(a) != shash(std::string("reliable"))) {
+        FAIL("string hashing is inconsistent");
+    }
+
+    return true;
+}
+
+bool test_build()
+{
+    std::unordered_map<int, int> golden;
+    std::vector<std::pair<int, int>> input;
+    for (int i = 0; i < 200000; ++i) {
+        int k = rand() % 150000;    // plenty of duplicates
+        input.emplace_back(k, i);
+        golden[k] = i;
+    }
+
+    ReliableHAMT<int, int, FT> rhamt(input.begin(), input.end(), 4);
+    if (rhamt.size() != golden.size()) {
+        printf("ERROR: %s %d: size mismatch (%lu != %lu)\n", __FILE__, __LINE__,
+                rhamt.size(), golden.size());
+        return false;
+    }
+    for (auto it : golden) {
+        const int *rv = rhamt.read(it.first);
+        if (nullptr == rv) {
+            FAIL("unexpected nullptr");
+        }
+        if (*rv != it.second) {
+            FAIL("later duplicate did not win");
+        }
+    }
+
+    // Building into a populated trie extends the existing subtrees
+    std::vector<std::pair<int, int>> more;
+    for (int i = 150000; i < 160000; ++i)
+        more.emplace_back(i, i);
+    rhamt.build(more.begin(), more.end(), 3);
+    if (rhamt.size() != golden.size() + more.size()) {
+        FAIL("size mismatch after second build");
+    }
+
+    return true;
+}
+
+template <class RHAMT>
+bool set_ops_match(const long keyspace, const int n)
+{
+    using K = typename RHAMT::key_type;
+    using V = typename RHAMT::mapped_type;
+    std::unordered_map<K, V> a, b;
+    RHAMT ta, tb;
+    for (int i = 0; i < n; ++i) {
+        K k = K(rand() % keyspace);
+        a[k] = V(i);
+        ta.insert(k, V(i));
+        k = K(rand() % keyspace);
+        b[k] = V(i + 1);
+        tb.insert(k, V(i + 1));
+    }
+    auto matches = [](RHAMT& t, const std::unordered_map<K, V>& golden) {
+        if (t.size() != golden.size() || t.inspect().count_mismatches)
+            return false;
+        for (auto &kv : golden) {
+            const V * rv = t.read(kv.first);
+            if (nullptr == rv || *rv != kv.second)
+                return false;
+        }
+        return true;
+    };
+
+    // Union, their values winning
+    auto u = a;
+    for (auto &kv : b)
+        u[kv.first] = kv.second;
+    RHAMT merged(ta);
+    if (merged.merge(tb, 4) != u.size() - a.size() || !matches(merged, u)) {
+        FAIL("merge mismatch");
+    }
+    // Adopted subtrees are shared: writing to either side leaves the other
+    for (auto &kv : b)
+        tb.insert(kv.first, V(0));
+    if (!matches(merged, u)) {
+        FAIL("merged trie changed by a write to its source");
+    }
+    for (auto &kv : b)
+        tb.insert(kv.first, kv.second);
+
+    // Intersection, keeping our values
+    std::unordered_map<K, V> x;
+    for (auto &kv : a)
+        if (b.count(kv.first))
+            x.insert(kv);
+    RHAMT common(ta);
+    if (common.intersect(tb, 4) != a.size() - x.size() || !matches(common, x)) {
+        FAIL("intersect mismatch");
+    }
+
+    // Differences, reported from several threads
+    std::mutex lock;
+    std::unordered_map<K, std::pair<bool, bool>> seen;
+    ta.diff(tb, [&](const K& k, const V * mine, const V * theirs) {
+        std::lock_guard<std::mutex> guard(lock);
+        seen[k] = { nullptr != mine, nullptr != theirs };
+    }, 4);
+    size_t expected = 0;
+    for (auto &kv : u) {
+        const bool in_a = a.count(kv.first), in_b = b.count(kv.first);
+        if (in_a && in_b && a[kv.first] == b[kv.first])
+            continue;
+        ++expected;
+        auto it = seen.find(kv.first);
+        if (it == seen.end() || it->second != std::make_pair(in_a, in_b)) {
+            FAIL("wrong difference reported");
+        }
+    }
+    if (seen.size() != expected) {
+        FAIL("extra difference reported");
+    }
+    // A trie and its copy share everything, so there is nothing to visit
+    RHAMT copy(ta);
+    copy.diff(ta, [&](const K&, const V *, const V *) { ++expected; });
+    if (seen.size() != expected) {
+        FAIL("difference reported between copies");
+    }
+
+    // Root tables fall back to key by key processing
+    if (sizeof(typename RHAMT::hash_type) < sizeof(uint32_t))
+        return true;
+    RHAMT tabled(ta);
+    tabled.set_root_bits(10);
+    tabled.merge(tb);
+    return matches(tabled, u);
+}
+
+bool test_set_operations()
+{
+    using Narrow = ReliableHAMT<int, int, FT, uint8_t>;
+    using Small = ReliableHAMT<uint16_t, uint16_t, FT>;
+    if (!set_ops_match<ReliableHAMT<int, int, FT>>(200000, 100000) ||
+            !set_ops_match<Narrow>(5000, 2000) ||
+            !set_ops_match<Small>(65536, 20000))
+        return false;
+
+    // The filter and change log see merged entries
+    ReliableHAMT<int, int, FT> a, b;
+    for (int i = 0; i < 1000; ++i) {
+        a.insert(2 * i, i);
+        b.insert(2 * i + 1, i);
+    }
+    a.set_negative_filter(1 << 16);
+    a.set_change_log(4096);
+    if (a.merge(b) != 1000 || a.change_seq() != 1000) {
+        FAIL("merge not logged");
+    }
+    for (int i = 0; i < 1000; ++i) {
+        if (nullptr == a.read(2 * i + 1)) {
+            FAIL("filter hides merged key");
+        }
+    }
+    b.remove(1);
+    if (a.intersect(b) != 1001 || a.change_seq() != 2001 || a.size() != 999) {
+        FAIL("intersect not logged");
+    }
+    return true;
+}
+
+/* A URL-like key; odd ones are too long to hold inline in an ArenaString */
+std::string url_key(const long i)
+{
+    return (i % 2 ? "https://example.org/items/" : "k") + std::to_string(i);
+}
+
+bool test_arena_keys()
+{
+    using ARHAMT = ReliableHAMT<ArenaString, int, FT>;
+    static constexpr int s = 20000;
+    if (MixHash<ArenaString>()(url_key(1)) != MixHash<std::string>()(url_key(1))
+            || ArenaString(url_key(1)) == ArenaString(url_key(3))) {
+        FAIL("ArenaString hashes or compares wrongly");
+    }
+
+    ARHAMT follower;
+    std::optional<ARHAMT::Snapshot> snap;
+    {
+        // Every key is made from a temporary string, so the trie must
+        // hold its own copy of the long ones
+        ARHAMT rhamt;
+        rhamt.set_change_log(4 * s);
+        for (int i = 0; i < s; ++i)
+            rhamt.insert(url_key(i), i);
+        for (int i = 0; i < s; ++i) {
+            const int * rv = rhamt.read(url_key(i));
+            if (nullptr == rv || *rv != i) {
+                FAIL("arena key not found");
+            }
+        }
+        snap.emplace(rhamt.snapshot());
+        for (int i = 0; i < s; i += 3)
+            rhamt.remove(url_key(i));
+
+        // Keys adopted from a merged trie outlive it
+        {
+            ARHAMT other;
+            for (int i = s; i < 2 * s; ++i)
+                other.insert(url_key(i), i);
+            if (rhamt.merge(other, 2) != size_t(s)) {
+                FAIL("merge of arena keys");
+            }
+        }
+        auto frozen = rhamt.freeze();
+        for (int i = 0; i < 2 * s; ++i) {
+            const int * rv = frozen.read(url_key(i));
+            if ((i < s && i % 3 == 0) != (nullptr == rv) ||
+                    (rv && *rv != i)) {
+                FAIL("frozen arena keys differ");
+            }
+        }
+
+        std::string delta;
+        rhamt.drain_changes(delta);
+        follower.apply_delta(delta, 0, 2);
+        if (follower.size() != rhamt.size() ||
+                rhamt.inspect().payload_bytes < size_t(s) * 24) {
+            FAIL("arena keys lost in the change log or uncounted");
+        }
+    }
+
+    // The snapshot and the follower still hold every key they should
+    for (int i = 0; i < 2 * s; ++i) {
+        const int * rv = snap->read(url_key(i));
+        const int * fv = follower.read(url_key(i));
+        if ((i < s) != (nullptr != rv) || (rv && *rv != i) ||
+                (i < s && i % 3 == 0) != (nullptr == fv) ||
+                (fv && *fv != i)) {
+            FAIL("arena keys do not outlive their trie");
+        }
+    }
+
+    // Long collision chains: 2000 keys share 256 hashes
+    ReliableHAMT<ArenaString, int, FT, uint8_t> narrow;
+    for (int i = 0; i < 2000; ++i)
+        narrow.insert(url_key(i), i);
+    for (int i = 0; i < 2000; i += 2)
+        narrow.remove(url_key(i));
+    for (int i = 0; i < 2000; ++i) {
+        const int * rv = narrow.read(url_key(i));
+        if ((i % 2) != (nullptr != rv) || (rv && *rv != i)) {
+            FAIL("colliding arena keys");
+        }
+    }
+    return true;
+}
+
+bool test_heterogeneous_lookup()
+{
+    using SRHAMT = ReliableHAMT<std::string, int, FT, uint32_t,
+                                MixHash<std::string>, std::equal_to<>>;
+    static constexpr int s = 20000;
+    SRHAMT rhamt;
+    for (int i = 0; i < s; i += 2)
+        rhamt.insert(url_key(i), i);
+    // The other half through a hash computed by the caller
+    for (int i = 1; i < s; i += 2) {
+        const std::string key = url_key(i);
+        rhamt.insert_hashed(fold_hash<uint32_t>(MixHash<std::string>()(key)),
+                            key, i);
+    }
+
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int i = 0; i < s + 100; ++i) {
+            const std::string key = url_key(i);
+            const std::string_view view(key);
+            const int * rv = rhamt.read(view);
+            if ((i < s) != (nullptr != rv) || (rv && *rv != i) ||
+                    rv != rhamt.read(key) ||
+                    rv != rhamt.read_hashed(
+                            fold_hash<uint32_t>(MixHash<std::string>()(view)),
+                            view) ||
+                    rhamt.contains(view) != (i < s)) {
+                FAIL("heterogeneous lookup disagrees");
+            }
+        }
+        rhamt.set_root_bits(10);
+    }
+
+    for (int i = 0; i < s; i += 3) {
+        const std::string key = url_key(i);
+        if (1 != rhamt.remove(std::string_view(key)) ||
+                0 != rhamt.remove(std::string_view(key)) ||
+                nullptr != rhamt.read(key.c_str())) {
+            FAIL("heterogeneous remove");
+        }
+    }
+    if (rhamt.size() != size_t(s - (s + 2) / 3)) {
+        FAIL("heterogeneous remove miscounted");
+    }
+
+    // Arena keys take plain strings as they are
+    ReliableHAMT<ArenaString, int, FT, uint32_t, MixHash<ArenaString>,
+                 std::equal_to<>> arena;
+    arena.insert(url_key(1), 1);
+    arena.insert("short", 2);
+    if (nullptr == arena.read(std::string_view(url_key(1))) ||
+            nullptr == arena.read("short") || arena.contains("shirt")) {
+        FAIL("heterogeneous arena lookup");
+    }
+    return true;
+}
+
+bool test_parallel_scan()
+{
+    ReliableHAMT<int, int, FT> rhamt;
+    std::unordered_map<int, int> golden;
+    if (rhamt.parallel_reduce([](int, int v) { return long(v); },
+                              std::plus<long>(), 4) != 0) {
+        FAIL("empty reduce is not the default value");
+    }
+    for (int i = 0; i < 100000; ++i) {
+        const int k = rand();
+        rhamt.insert(k, i);
+        golden[k] = i;
+    }
+    long expect = 0;
+    for (auto &kv : golden)
+        expect += kv.second;
+
+    std::vector<int> order;
+    for (int pass = 0; pass < 2; ++pass) {
+        for (unsigned threads : { 1u, 3u, 8u }) {
+            auto sum = rhamt.parallel_reduce(
+                    [](int, int v) { return long(v); }, std::plus<long>(),
+                    threads);
+            std::atomic<size_t> seen(0);
+            std::mutex lock;
+            std::unordered_map<int, int> visited;
+            rhamt.parallel_for_each([&](int k, int v) {
+                ++seen;
+                std::lock_guard<std::mutex> guard(lock);
+                visited[k] = v;
+            }, threads);
+            if (sum != expect || seen != golden.size() || visited != golden) {
+                FAIL("parallel scan missed or repeated entries");
+            }
+
+            // Partial results are combined in the same order every time
+            auto keys = rhamt.parallel_reduce(
+                    [](int k, int) { return std::vector<int>{ k }; },
+                    [](std::vector<int> a, std::vector<int> b) {
+                        a.insert(a.end(), b.begin(), b.end());
+                        return a;
+                    }, threads);
+            if (order.empty())
+                order = keys;
+            if (keys != order) {
+                FAIL("parallel reduce order depends on the threads");
+            }
+        }
+        rhamt.set_root_bits(10);
+        order.clear();
+    }
+    return true;
+}
+
+bool test_capacity()
+{
+    for (unsigned bits : { 0u, 10u }) {
+        ReliableHAMT<int, int, FT> rhamt;
+        rhamt.set_root_bits(bits);
+        rhamt.set_capacity(1000);
+        for (int i = 0; i < 100000; ++i) {
+            const int * rv = rhamt.insert(i, -i);
+            if (nullptr == rv || *rv != -i) {
+                FAIL("insert returned a bad pointer");
+            }
+            if (rhamt.size() > 1000) {
+                FAIL("trie grew past its capacity");
+            }
+            // Keys read between inserts are never evicted
+            for (int k = 0; k < 100 && k <= i; ++k) {
+                if (nullptr == rhamt.read(k)) {
+                    FAIL("a referenced key was evicted");
+                }
+            }
+        }
+        auto stats = rhamt.inspect();
+        if (stats.entries != rhamt.size() || stats.count_mismatches != 0) {
+            FAIL("eviction left counts out of step");
+        }
+
+        // A snapshot keeps what the trie evicts
+        auto snap = rhamt.snapshot();
+        rhamt.set_capacity(100);
+        if (rhamt.size() != 100 || snap.size() != 1000) {
+            FAIL("lowering the capacity did not evict");
+        }
+        for (int k = 0; k < 100; ++k) {
+            if (nullptr == rhamt.read(k) || nullptr == snap.read(k)) {
+                FAIL("a referenced key was evicted");
+            }
+        }
+        if (rhamt.inspect().entries != 100) {
+            FAIL("eviction left counts out of step");
+        }
+
+        // Bulk loads are trimmed too, and evictions are logged as removes
+        ReliableHAMT<int, int, FT> follower(rhamt);
+        follower.set_capacity(0);
+        rhamt.set_change_log(100000);
+        std::vector<std::pair<int, int>> batch;
+        for (int i = 0; i < 5000; ++i)
+            batch.emplace_back(1000000 + i, i);
+        rhamt.build(batch.begin(), batch.end(), 4);
+        std::string deltas;
+        rhamt.drain_changes(deltas);
+        follower.apply_delta(deltas, 0);
+        if (rhamt.size() != 100 || follower.size() != rhamt.size() ||
+                follower.inspect().entries != 100) {
+            FAIL("bulk load was not trimmed to the capacity");
+        }
+        for (int i = 0; i < 5000; ++i) {
+            if (rhamt.contains(1000000 + i) != follower.contains(1000000 + i)) {
+                FAIL("follower disagrees on evicted keys");
+            }
+        }
+    }
+    return true;
+}
+
+bool test_order_statistics()
+{
+    for (unsigned bits : { 0u, 10u, 15u }) {
+        ReliableHAMT<int, int, FT> rhamt;
+        rhamt.set_root_bits(bits);
+        std::mt19937 rng(7);
+        if (rhamt.nth_by_hash(0) || rhamt.sample(rng) || rhamt.rank(5) != 0) {
+            FAIL("empty trie has an entry");
+        }
+        std::unordered_map<int, int> golden;
+        for (int i = 0; i < 50000; ++i) {
+            const int k = rand() % 100000;
+            if (i % 3 == 2) {
+                rhamt.remove(k);
+                golden.erase(k);
+            }
+            else {
+                rhamt.insert(k, i);
+                golden[k] = i;
+            }
+        }
+        if (rhamt.size() != golden.size() ||
+                rhamt.inspect().count_mismatches != 0) {
+            FAIL("counts drifted on the fast path");
+        }
+        // Laying out the table again recomputes its totals
+        if (15 == bits) {
+            rhamt.set_root_bits(10);
+            rhamt.set_root_bits(15);
+        }
+
+        // Hash order is the order of the scans
+        auto order = rhamt.parallel_reduce(
+                [](int k, int) { return std::vector<int>{ k }; },
+                [](std::vector<int> a, std::vector<int> b) {
+                    a.insert(a.end(), b.begin(), b.end());
+                    return a;
+                });
+        for (size_t i = 0; i < order.size(); ++i) {
+            auto e = rhamt.nth_by_hash(i);
+            if (!e || e->first != order[i] || e->second != golden[order[i]]) {
+                FAIL("nth_by_hash returned the wrong entry");
+            }
+            if (rhamt.rank(order[i]) != i) {
+                FAIL("rank disagrees with nth_by_hash");
+            }
+        }
+        if (rhamt.nth_by_hash(order.size())) {
+            FAIL("nth_by_hash past the end found an entry");
+        }
+        for (int k = 100000; k < 101000; ++k) {
+            const size_t r = rhamt.rank(k);
+            if (r > order.size() || (r > 0 && rhamt.rank(order[r-1]) >= r)) {
+                FAIL("rank of a missing key is out of place");
+            }
+        }
+
+        // Every key is about equally likely to be drawn
+        ReliableHAMT<int, int, FT> small;
+        small.set_root_bits(bits);
+        for (int k = 0; k < 1000; ++k)
+            small.insert(k, k);
+        std::vector<int> drawn(1000, 0);
+        for (int i = 0; i < 200000; ++i) {
+            auto e = small.sample(rng);
+            if (!e || e->first != e->second) {
+                FAIL("sample returned a bad entry");
+            }
+            ++drawn[e->first];
+        }
+        for (int n : drawn) {
+            if (n < 100 || n > 300) {
+                FAIL("sample is not uniform");
+            }
+        }
+    }
+    return true;
+}
+
+bool test_sharded()
+{
+    ShardedReliableHAMT<int, int, FT> rhamt(3);
+    static constexpr int nthreads = 4;
+    static constexpr int per_thread = 10000;
+
+    std::vector<std::thread> writers;
+    for (int t = 0; t < nthreads; ++t) {
+        writers.emplace_back([&rhamt, t]() {
+            for (int i = t * per_thread; i < (t + 1) * per_thread; ++i)
+                rhamt.insert(i, -i);
+        });
+    }
+    for (auto &w : writers)
+        w.join();
+
+    if (rhamt.size() != nthreads * per_thread) {
+        printf("ERROR: %s %d: size is %lu, expected %d\n", __FILE__, __LINE__,
+                rhamt.size(), nthreads * per_thread);
+        return false;
+    }
+
+    std::vector<std::pair<int, int>> batch;
+    for (int i = 0; i < nthreads * per_thread; ++i)
+        batch.emplace_back(i, i);
+    rhamt.insert(batch.begin(), batch.end(), nthreads);
+
+    std::vector<int> keys;
+    for (int i = 0; i < nthreads * per_thread; ++i)
+        keys.push_back(i);
+    std::vector<const int *> vals;
+    rhamt.read(keys.begin(), keys.end(), std::back_inserter(vals), nthreads);
+    for (int i = 0; i < nthreads * per_thread; ++i) {
+        if (nullptr == vals[i]) {
+            FAIL("unexpected nullptr");
+        }
+        if (i != *vals[i]) {
+            FAIL("batched insert did not overwrite");
+        }
+    }
+
+    size_t removed = rhamt.remove(keys.begin(), keys.end(), nthreads);
+    if (removed != keys.size() || !rhamt.empty()) {
+        FAIL("batched remove left keys behind");
+    }
+
+    return true;
+}
+
+ nanos test_timing_access_built()
+{
+    // Get Duration of 1,000,000 accesses to an already built Trie
+    ReliableHAMT<int, int, FT> rhamt;
+    static constexpr int s = 1000000;
+    for (int i = 0; i < s; ++i) {
+        rhamt.insert(i, s);
+    }
+
+    auto lstime = std::chrono::high_resolution_clock::now();
+    for (volatile int i = 0; i < s; ++i) ;
+    auto letime = std::chrono::high_resolution_clock::now();
+    auto ldur = letime - lstime;
+    // printf("loop duration: %lu nanos / iteration\n", ldur.count() / s);
+    // Loop duration is ~ 1 ns / iter
+    
+    auto stime = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < s; ++i) {
+        volatile int k = *rhamt.read(s - 1);
+        (void)k;
+    }
+    auto etime = std::chrono::high_resolution_clock::now();
+
+    auto dur = etime - stime;
+    return dur - ldur;;
+}
+
+nanos timing_reads_verified(ReliableHAMT<int, int, FT>::verify mode)
+{
+    // Duration of 1,000,000 distinct reads under the given verification mode.
+    // All modes share one warmed-up trie so that they see the same layout.
+    static constexpr int s = 1000000;
+    static ReliableHAMT<int, int, FT> rhamt;
+    if (rhamt.empty()) {
+        for (int i = 0; i < s; ++i)
+            rhamt.insert(i, i);
+    }
+    rhamt.set_verification(mode, 64);
+    for (int i = 0; i < s; ++i) {
+        volatile int k = *rhamt.read(i);
+        (void)k;
+    }
+
+    auto stime = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < s; ++i) {
+        volatile int k = *rhamt.read(i);
+        (void)k;
+    }
+    auto etime = std::chrono::high_resolution_clock::now();
+    return etime - stime;
+}
+
+nanos test_timing_reads_verify_always()
+    { return timing_reads_verified(ReliableHAMT<int, int, FT>::verify::always); }
+
+nanos test_timing_reads_verify_replica()
+    { return timing_reads_verified(ReliableHAMT<int, int, FT>::verify::replica); }
+
+nanos test_timing_reads_verify_sampled()
+    { return timing_reads_verified(ReliableHAMT<int, int, FT>::verify::sampled); }
+
+nanos test_timing_build_trie_random()
+{
+    ReliableHAMT<int, int, FT> rhamt;
+    static constexpr int s = 1000000;
+    volatile int k;
+
+    auto lstime = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < s; ++i) {
+        k = rand();
+        // rhamt.insert(s, s);
+    }
+    (void)k;
+    auto letime = std::chrono::high_resolution_clock::now();
+    auto ldur = letime - lstime;
+
+    auto stime = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < s; ++i) {
+        rhamt.insert(rand(), s);
+    }
+    auto etime = std::chrono::high_resolution_clock::now();
+    auto dur = etime - stime;
+    return dur - ldur;
+}
+
+nanos test_timing_bulk_build_random()
+{
+    static constexpr int s = 1000000;
+    std::vector<std::pair<int, int>> input;
+    for (int i = 0; i < s; ++i)
+        input.emplace_back(rand(), s);
+
+    auto stime = std::chrono::high_resolution_clock::now();
+    ReliableHAMT<int, int, FT> rhamt(input.begin(), input.end(),
+                                     std::thread::hardware_concurrency());
+    auto etime = std::chrono::high_resolution_clock::now();
+    std::cout << "  " << rhamt.inspect().bytes_per_key() << " bytes/key\n";
+    return etime - stime;
+}
+
+nanos timing_negative_reads(bool filtered)
+{
+    // Duration of 1,000,000 reads of absent keys (rand() never sets the
+    // sign bit). With 1M keys stored, the upper levels of the trie are full,
+    // so misses end deep in the trie rather than at the root.
+    static constexpr int s = 1000000;
+    ReliableHAMT<int, int, FT> rhamt;
+    for (int i = 0; i < s; ++i)
+        rhamt.insert(rand(), i);
+    if (filtered)
+        rhamt.set_negative_filter(10 * s);
+
+    auto stime = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < s; ++i) {
+        volatile const int *rv = rhamt.read(rand() | INT_MIN);
+        (void)rv;
+    }
+    auto etime = std::chrono::high_resolution_clock::now();
+    return etime - stime;
+}
+
+nanos test_timing_negative_reads()
+    { return timing_negative_reads(false); }
+
+nanos test_timing_negative_reads_filtered()
+    { return timing_negative_reads(true); }
+
+template <class Hash>
+nanos timing_hash_keys(const int kind)
+{
+    // Duration of hashing and of inserting 1,000,000 keys of the given kind
+    static constexpr int s = 1000000;
+    std::vector<int> keys = hash_key_set(kind, s);
+    ReliableHAMT<int, int, FT, uint32_t, Hash> rhamt;
+    Hash hasher;
+    volatile size_t sink = 0;
+
+    auto hstime = std::chrono::high_resolution_clock::now();
+    for (int k : keys)
+        sink = sink + hasher(k);
+    auto hetime = std::chrono::high_resolution_clock::now();
+
+    auto stime = std::chrono::high_resolution_clock::now();
+    for (int k : keys)
+        rhamt.insert(k, k);
+    auto etime = std::chrono::high_resolution_clock::now();
+    printf("  hashing: %ld ns / per op\n",
+            (long)(nanos(hetime - hstime).count() / s));
+    return etime - stime;
+}
+
+nanos test_timing_mixhash_sequential()
+    { return timing_hash_keys<MixHash<int>>(0); }
+nanos test_timing_mixhash_clustered()
+    { return timing_hash_keys<MixHash<int>>(1); }
+nanos test_timing_mixhash_random()
+    { return timing_hash_keys<MixHash<int>>(2); }
+nanos test_timing_stdhash_sequential()
+    { return timing_hash_keys<std::hash<int>>(0); }
+nanos test_timing_stdhash_clustered()
+    { return timing_hash_keys<std::hash<int>>(1); }
+nanos test_timing_stdhash_random()
+    { return timing_hash_keys<std::hash<int>>(2); }
+
+nanos timing_root_table(const unsigned bits)
+{
+    // Duration of 1,000,000 random reads from a 1M key trie whose top
+    // `bits` of hash are resolved by the root table
+    static constexpr int s = 1000000;
+    static std::vector<int> keys;
+    static ReliableHAMT<int, int, FT> rhamt;
+    if (keys.empty()) {
+        for (int i = 0; i < s; ++i) {
+            keys.push_back(rand());
+            rhamt.insert(keys.back(), i);
+        }
+    }
+    rhamt.set_root_bits(bits);
+    for (int i = 0; i < s; ++i)
+        rhamt.read(keys[i]);
+
+    auto stime = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < s; ++i) {
+        volatile const int *rv = rhamt.read(keys[(i * 7919L) % s]);
+        (void)rv;
+    }
+    auto etime = std::chrono::high_resolution_clock::now();
+    return etime - stime;
+}
+
+nanos timing_frozen_reads(const bool frozen)
+{
+    // Duration of 1,000,000 random reads from a 1M key trie, mutable or
+    // frozen, also reporting the heap used per entry
+    static constexpr int s = 1000000;
+    std::vector<int> keys;
+    std::vector<std::pair<int, int>> input;
+    for (int i = 0; i < s; ++i) {
+        keys.push_back(rand());
+        input.emplace_back(keys.back(), i);
+    }
+#ifdef __GLIBC__
+    size_t before = mallinfo2().uordblks;
+#endif
+    std::optional<ReliableHAMT<int, int, FT>> hot;
+    std::optional<FrozenReliableHAMT<int, int, FT>> cold;
+    if (frozen) {
+        ReliableHAMT<int, int, FT> rhamt(input.begin(), input.end());
+        cold.emplace(rhamt);
+    }
+    else {
+        hot.emplace(input.begin(), input.end());
+    }
+#ifdef __GLIBC__
+    printf("  heap: %zu bytes / per entry\n",
+            (mallinfo2().uordblks - before) / s);
+#endif
+
+    auto stime = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < s; ++i) {
+        int k = keys[(i * 7919L) % s];
+        volatile const int *rv = frozen ? cold->read(k) : hot->read(k);
+        (void)rv;
+    }
+    auto etime = std::chrono::high_resolution_clock::now();
+    return etime - stime;
+}
+
+nanos timing_snapshot_writes(const int period)
+{
+    // Duration of 1,000,000 random overwrites of a 1M key trie, taking a
+    // snapshot every `period` writes (never if 0), so that writes after
+    // each one copy their path
+    static constexpr int s = 1000000;
+    std::vector<std::pair<int, int>> input;
+    for (int i = 0; i < s; ++i)
+        input.emplace_back(rand(), i);
+    ReliableHAMT<int, int, FT> rhamt(input.begin(), input.end());
+    std::optional<ReliableHAMT<int, int, FT>::Snapshot> snap;
+
+    auto stime = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < s; ++i) {
+        if (period && 0 == i % period)
+            snap.emplace(rhamt.snapshot());
+        rhamt.insert(input[(i * 7919L) % s].first, i);
+    }
+    auto etime = std::chrono::high_resolution_clock::now();
+    return etime - stime;
+}
+
+nanos test_timing_writes_no_snapshot()
+    { return timing_snapshot_writes(0); }
+
+nanos test_timing_writes_snapshot_1000()
+    { return timing_snapshot_writes(1000); }
+
+nanos test_timing_replicate_changes()
+{
+    // Duration of draining and applying 100,000 random writes to a 1M key
+    // trie on a follower holding the same keys
+    static constexpr int s = 1000000;
+    std::vector<std::pair<int, int>> input;
+    for (int i = 0; i < s; ++i)
+        input.emplace_back(rand(), i);
+    ReliableHAMT<int, int, FT> leader(input.begin(), input.end());
+    ReliableHAMT<int, int, FT> follower(input.begin(), input.end());
+    leader.set_change_log(100000);
+    for (int i = 0; i < 100000; ++i)
+        leader.insert(input[(i * 7919L) % s].first, -i);
+
+    auto stime = std::chrono::high_resolution_clock::now();
+    std::string delta;
+    leader.drain_changes(delta);
+    follower.apply_delta(delta, 0);
+    auto etime = std::chrono::high_resolution_clock::now();
+    printf("  delta: %zu bytes / per change\n", delta.size() / 100000);
+    return etime - stime;
+}
+
+nanos timing_journal(const size_t batch, const long interval_us)
+{
+    // Duration of 64 threads making 100 durable inserts each, with a sync
+    // for every insert (interval 0) or group commits of up to `batch`
+    static constexpr int nthreads = 64, per = 100;
+    const std::string path = "/tmp/rhamt_bench_journal.log";
+    unlink(path.c_str());
+    auto stime = std::chrono::high_resolution_clock::now();
+    {
+        JournaledReliableHAMT<int, int, FT> journal(path, batch,
+                                    std::chrono::microseconds(interval_us));
+        std::vector<std::thread> pool;
+        for (int t = 0; t < nthreads; ++t) {
+            pool.emplace_back([&journal, t]() {
+                for (int i = 0; i < per; ++i)
+                    journal.insert(t * per + i, i);
+            });
+        }
+        for (auto &th : pool)
+            th.join();
+        printf("  %zu syncs\n", journal.syncs());
+    }
+    auto etime = std::chrono::high_resolution_clock::now();
+    unlink(path.c_str());
+    return etime - stime;
+}
+
+nanos test_timing_journal_sync_every_op()
+    { return timing_journal(1, 0); }
+nanos test_timing_journal_group_4()
+    { return timing_journal(4, 200); }
+nanos test_timing_journal_group_16()
+    { return timing_journal(16, 200); }
+nanos test_timing_journal_group_64()
+    { return timing_journal(64, 200); }
+
+nanos test_timing_mutable_reads()
+    { return timing_frozen_reads(false); }
+
+nanos test_timing_frozen_reads()
+    { return timing_frozen_reads(true); }
+
+nanos test_timing_root_table_0()
+    { return timing_root_table(0); }
+nanos test_timing_root_table_15()
+    { return timing_root_table(15); }
+nanos test_timing_root_table_20()
+    { return timing_root_table(20); }
+
+nanos timing_merge(const bool by_key)
+{
+    // Duration of merging a 200,000 key trie into another with half of its
+    // keys, either structurally or by reading every key of the source (as
+    // listed by the caller) and inserting those that differ
+    static constexpr int s = 200000;
+    ReliableHAMT<int, int, FT> mine, theirs;
+    std::vector<int> keys;
+    for (int i = 0; i < s; ++i) {
+        keys.push_back(i % 2 ? rand() : i);
+        theirs.insert(keys.back(), i);
+        mine.insert(i % 2 ? rand() : i, i + 1);
+    }
+
+    auto stime = std::chrono::high_resolution_clock::now();
+    if (by_key) {
+        for (int k : keys) {
+            const int * theirs_val = theirs.read(k);
+            const int * mine_val = mine.read(k);
+            if (nullptr == mine_val || *mine_val != *theirs_val)
+                mine.insert(k, *theirs_val);
+        }
+    }
+    else {
+        mine.merge(theirs, std::thread::hardware_concurrency());
+    }
+    auto etime = std::chrono::high_resolution_clock::now();
+    return etime - stime;
+}
+
+nanos test_timing_merge_by_key()
+    { return timing_merge(true); }
+nanos test_timing_merge_structural()
+    { return timing_merge(false); }
+
+template <template <class, size_t, unsigned> class Protect>
+nanos timing_slot_reads()
+{
+    // Duration of 1,000,000 random reads from a 1M key trie protected by
+    // `Protect`
+    static constexpr int s = 1000000;
+    ReliableHAMT<int, int, FT, uint32_t, MixHash<int>, std::equal_to<int>,
+                 std::allocator<std::pair<const int, int>>, Protect> rhamt;
+    std::vector<int> keys;
+    for (int i = 0; i < s; ++i) {
+        keys.push_back(rand());
+        rhamt.insert(keys.back(), i);
+    }
+
+    auto stime = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < s; ++i) {
+        volatile const int *rv = rhamt.read(keys[(i * 7919L) % s]);
+        (void)rv;
+    }
+    auto etime = std::chrono::high_resolution_clock::now();
+    return etime - stime;
+}
+
+nanos test_timing_replicated_slot_reads()
+    { return timing_slot_reads<ReplicatedSlots>(); }
+nanos test_timing_numa_slot_reads()
+    { return timing_slot_reads<NumaSlots>(); }
+
+template <class V>
+nanos timing_small_entries()
+{
+    // Duration of inserting and reading back every 16-bit key, also
+    // reporting the heap used per entry. The identity hash on a 16-bit
+    // HashType packs the keys densely, so the leaves dominate memory.
+    static constexpr int s = 65536;
+#ifdef __GLIBC__
+    size_t before = mallinfo2().uordblks;
+#endif
+    auto stime = std::chrono::high_resolution_clock::now();
+    ReliableHAMT<uint16_t, V, FT, uint16_t, std::hash<uint16_t>> rhamt;
+    for (int i = 0; i < s; ++i)
+        rhamt.insert(i, i);
+    for (int i = 0; i < s; ++i) {
+        volatile V v = *rhamt.read(i);
+        (void)v;
+    }
+    auto etime = std::chrono::high_resolution_clock::now();
+#ifdef __GLIBC__
+    printf("  heap: %zu bytes / per entry\n",
+            (mallinfo2().uordblks - before) / s);
+#endif
+    return etime - stime;
+}
+
+nanos test_timing_inline_entries()
+    { return timing_small_entries<uint16_t>(); }
+
+nanos test_timing_leaf_entries()
+    { return timing_small_entries<uint64_t>(); }
+
+template <class K>
+nanos timing_string_keys()
+{
+    // Duration of inserting 200,000 URL keys of 35-40 bytes and reading
+    // them back, also reporting the heap used per entry
+    static constexpr long s = 200000;
+    std::vector<std::string> keys;
+    for (long i = 0; i < s; ++i)
+        keys.push_back(url_key(2 * i + 1) + "/detail");
+#ifdef __GLIBC__
+    size_t before = mallinfo2().uordblks;
+#endif
+    auto stime = std::chrono::high_resolution_clock::now();
+    ReliableHAMT<K, int, FT> rhamt;
+    for (long i = 0; i < s; ++i)
+        rhamt.insert(keys[i], i);
+    for (long i = 0; i < s; ++i) {
+        volatile int v = *rhamt.read(keys[(i * 7919) % s]);
+        (void)v;
+    }
+    auto etime = std::chrono::high_resolution_clock::now();
+#ifdef __GLIBC__
+    printf("  heap: %zu bytes / per entry\n",
+            (mallinfo2().uordblks - before) / s);
+#endif
+    return etime - stime;
+}
+
+nanos test_timing_std_string_keys()
+    { return timing_string_keys<std::string>(); }
+nanos test_timing_arena_string_keys()
+    { return timing_string_keys<ArenaString>(); }
+
+nanos timing_view_reads(const bool transparent)
+{
+    // Duration of 1,000,000 reads of std::string keys of 35-40 bytes given
+    // as std::string_views, either looked up as they are or by first making
+    // a std::string as a non-transparent trie requires
+    static constexpr long s = 200000;
+    ReliableHAMT<std::string, int, FT, uint32_t, MixHash<std::string>,
+                 std::equal_to<>> rhamt;
+    std::vector<std::string> keys;
+    for (long i = 0; i < s; ++i) {
+        keys.push_back(url_key(2 * i + 1) + "/detail");
+        rhamt.insert(keys.back(), i);
+    }
+    std::vector<std::string_view> views(keys.begin(), keys.end());
+
+    auto stime = std::chrono::high_resolution_clock::now();
+    for (long i = 0; i < 1000000; ++i) {
+        const std::string_view key = views[(i * 7919) % s];
+        volatile const int * rv = transparent ? rhamt.read(key)
+                                              : rhamt.read(std::string(key));
+        (void)rv;
+    }
+    auto etime = std::chrono::high_resolution_clock::now();
+    return etime - stime;
+}
+
+nanos test_timing_string_reads_by_copy()
+    { return timing_view_reads(false); }
+nanos test_timing_string_reads_by_view()
+    { return timing_view_reads(true); }
+
+nanos timing_scan(const unsigned threads)
+{
+    // Duration of summing the values of a 1M key trie with parallel_reduce
+    static constexpr int s = 1000000;
+    ReliableHAMT<int, int, FT> rhamt;
+    for (int i = 0; i < s; ++i)
+        rhamt.insert(rand(), i);
+
+    auto stime = std::chrono::high_resolution_clock::now();
+    volatile long sum = rhamt.parallel_reduce(
+            [](int, int v) { return long(v); }, std::plus<long>(), threads);
+    (void)sum;
+    auto etime = std::chrono::high_resolution_clock::now();
+    return etime - stime;
+}
+
+nanos test_timing_scan_1_thread()
+    { return timing_scan(1); }
+nanos test_timing_scan_all_threads()
+    { return timing_scan(std::thread::hardware_concurrency()); }
+
+nanos timing_zipf_cache(const size_t capacity)
+{
+    // Duration of 1,000,000 lookups drawn from a Zipfian (s = 0.99)
+    // distribution over 1,000,000 keys, inserting each key that misses,
+    // also reporting the hit rate. A capacity of 0 keeps every key.
+    static constexpr int n = 1000000;
+    static constexpr int ops = 1000000;
+    std::vector<double> cdf(n);
+    double total = 0;
+    for (int r = 0; r < n; ++r)
+        cdf[r] = total += 1.0 / std::pow(r + 1, 0.99);
+    std::mt19937_64 rng(42);
+    std::uniform_real_distribution<double> uniform(0, total);
+    std::vector<int> trace(ops);
+    for (auto &k : trace) {
+        const int rank = std::lower_bound(cdf.begin(), cdf.end(),
+                                          uniform(rng)) - cdf.begin();
+        k = int(uint32_t(rank) * 2654435761u);   // scatter the hot keys
+    }
+
+    ReliableHAMT<int, int, FT> rhamt;
+    rhamt.set_capacity(capacity);
+    size_t hits = 0;
+    auto stime = std::chrono::high_resolution_clock::now();
+    for (int k : trace) {
+        if (nullptr != rhamt.read(k))
+            ++hits;
+        else
+            rhamt.insert(k, k);
+    }
+    auto etime = std::chrono::high_resolution_clock::now();
+    printf("  hit rate: %.1f%% with %zu keys\n", 100.0 * hits / ops,
+            rhamt.size());
+    return etime - stime;
+}
+
+nanos test_timing_zipf_unbounded()
+    { return timing_zipf_cache(0); }
+nanos test_timing_zipf_cache_100k()
+    { return timing_zipf_cache(100000); }
+nanos test_timing_zipf_cache_10k()
+    { return timing_zipf_cache(10000); }
+
+nanos timing_order_statistics(const bool by_rank)
+{
+    // Duration of 1,000,000 uniform samples, or of ranking 1,000,000 keys,
+    // in a 1M key trie
+    static constexpr int s = 1000000;
+    ReliableHAMT<int, int, FT> rhamt;
+    std::vector<int> keys(s);
+    for (int i = 0; i < s; ++i) {
+        keys[i] = rand();
+        rhamt.insert(keys[i], i);
+    }
+    std::mt19937_64 rng(42);
+
+    auto stime = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < s; ++i) {
+        if (by_rank) {
+            volatile size_t r = rhamt.rank(keys[i]);
+            (void)r;
+        }
+        else {
+            volatile int v = rhamt.sample(rng)->second;
+            (void)v;
+        }
+    }
+    auto etime = std::chrono::high_resolution_clock::now();
+    return etime - stime;
+}
+
+nanos test_timing_sample()
+    { return timing_order_statistics(false); }
+nanos test_timing_rank()
+    { return timing_order_statistics(true); }
+
+nanos test_timing_build_trie_sequential()
+{
+    ReliableHAMT<int, int, FT> rhamt;
+    static constexpr int s = 1000000;
+    volatile int k;
+
+    auto lstime = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < s; ++i) k = i;
+    (void)k;
+    auto letime = std::chrono::high_resolution_clock::now();
+    auto ldur = letime - lstime;
+
+    auto stime = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < s; ++i) {
+        rhamt.insert(i, s);
+    }
+    auto etime = std::chrono::high_resolution_clock::now();
+    auto dur = etime - stime;
+    return dur - ldur;
+}
+
+int main(void)
+{
+    printf("Beginning Testing...\n");
+    srand(time(NULL));
+    TimingTest ttest;
+
+    unit_test(test_small_rhamt, "test_small_rhamt");
+    unit_test(test_random_sparse, "test_random_sparse");
     // unit_test(test_overwrite, "test_overwrite");
     // unit_test(test_random_dense, "test_random_dense");
     // unit_test(test_string_key, "test_string_key");
-    // unit_test(test_missing_read, "test_missing_read");
-    // unit_test(test_missing_remove, "test_missing_remove");
+    unit_test(test_missing_read, "test_missing_read");
+    unit_test(test_missing_remove, "test_missing_remove");
+    unit_test(test_negative_filter, "test_negative_filter");
+    unit_test(test_inline_entries, "test_inline_entries");
+    unit_test(test_root_table, "test_root_table");
+    unit_test(test_freeze, "test_freeze");
+    unit_test(test_snapshot, "test_snapshot");
+    unit_test(test_change_log, "test_change_log");
+    unit_test(test_journal, "test_journal");
+    unit_test(test_journal_failure, "test_journal_failure");
+    unit_test(test_numa_slots, "test_numa_slots");
+    unit_test(test_inspect, "test_inspect");
+    unit_test(test_remove_reclaims, "test_remove_reclaims");
+    unit_test(test_concurrent_reads, "test_concurrent_reads");
+    unit_test(test_reed_solomon_slots, "test_reed_solomon_slots");
+    unit_test(test_reed_solomon_rhamt, "test_reed_solomon_rhamt");
+    unit_test(test_hash_distribution, "test_hash_distribution");
+    unit_test(test_build, "test_build");
+    unit_test(test_sharded, "test_sharded");
+    unit_test(test_set_operations, "test_set_operations");
+    unit_test(test_arena_keys, "test_arena_keys");
+    unit_test(test_heterogeneous_lookup, "test_heterogeneous_lookup");
+    unit_test(test_parallel_scan, "test_parallel_scan");
+    unit_test(test_capacity, "test_capacity");
+    unit_test(test_order_statistics, "test_order_statistics");
     ttest.name = "test_timing_access_to_built_rhamt";
     ttest.test = test_timing_access_built;
     ttest.numops = 1000000;
@@ -344,10 +2478,145 @@ int main(void)
     ttest.test = test_timing_build_trie_random;
     ttest.name = "test_timing_build_trie_random";
     unit_test(nullptr, "test_timing_build_trie_random", true, &ttest);
+    ttest.test = test_timing_bulk_build_random;
+    ttest.name = "test_timing_bulk_build_random";
+    unit_test(nullptr, ttest.name, true, &ttest);
     ttest.test = test_timing_build_trie_sequential;
     ttest.name = "test_timing_build_trie_sequential";
     unit_test(nullptr, "test_timing_build_trie_sequential", true, &ttest);
 
+    ttest.numops = 2 * 65536;
+    ttest.test = test_timing_inline_entries;
+    ttest.name = "test_timing_inline_entries";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_leaf_entries;
+    ttest.name = "test_timing_leaf_entries";
+    unit_test(nullptr, ttest.name, true, &ttest);
+
+    ttest.numops = 2 * 200000;
+    ttest.test = test_timing_std_string_keys;
+    ttest.name = "test_timing_std_string_keys";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_arena_string_keys;
+    ttest.name = "test_timing_arena_string_keys";
+    unit_test(nullptr, ttest.name, true, &ttest);
+
+    ttest.numops = 1000000;
+    ttest.test = test_timing_string_reads_by_copy;
+    ttest.name = "test_timing_string_reads_by_copy";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_string_reads_by_view;
+    ttest.name = "test_timing_string_reads_by_view";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_scan_1_thread;
+    ttest.name = "test_timing_scan_1_thread";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_scan_all_threads;
+    ttest.name = "test_timing_scan_all_threads";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_zipf_unbounded;
+    ttest.name = "test_timing_zipf_unbounded";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_zipf_cache_100k;
+    ttest.name = "test_timing_zipf_cache_100k";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_zipf_cache_10k;
+    ttest.name = "test_timing_zipf_cache_10k";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_sample;
+    ttest.name = "test_timing_sample";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_rank;
+    ttest.name = "test_timing_rank";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_mixhash_sequential;
+    ttest.name = "test_timing_mixhash_sequential";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_mixhash_clustered;
+    ttest.name = "test_timing_mixhash_clustered";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_mixhash_random;
+    ttest.name = "test_timing_mixhash_random";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_stdhash_sequential;
+    ttest.name = "test_timing_stdhash_sequential";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_stdhash_clustered;
+    ttest.name = "test_timing_stdhash_clustered";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_stdhash_random;
+    ttest.name = "test_timing_stdhash_random";
+    unit_test(nullptr, ttest.name, true, &ttest);
+
+    ttest.test = test_timing_negative_reads;
+    ttest.name = "test_timing_negative_reads";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_negative_reads_filtered;
+    ttest.name = "test_timing_negative_reads_filtered";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_mutable_reads;
+    ttest.name = "test_timing_mutable_reads";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_frozen_reads;
+    ttest.name = "test_timing_frozen_reads";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_writes_no_snapshot;
+    ttest.name = "test_timing_writes_no_snapshot";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_writes_snapshot_1000;
+    ttest.name = "test_timing_writes_snapshot_1000";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.numops = 100000;
+    ttest.test = test_timing_replicate_changes;
+    ttest.name = "test_timing_replicate_changes";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.numops = 6400;
+    ttest.test = test_timing_journal_sync_every_op;
+    ttest.name = "test_timing_journal_sync_every_op";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_journal_group_4;
+    ttest.name = "test_timing_journal_group_4";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_journal_group_16;
+    ttest.name = "test_timing_journal_group_16";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_journal_group_64;
+    ttest.name = "test_timing_journal_group_64";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.numops = 1000000;
+    ttest.test = test_timing_root_table_0;
+    ttest.name = "test_timing_root_table_0";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_root_table_15;
+    ttest.name = "test_timing_root_table_15";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_root_table_20;
+    ttest.name = "test_timing_root_table_20";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.numops = 200000;
+    ttest.test = test_timing_merge_by_key;
+    ttest.name = "test_timing_merge_by_key";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_merge_structural;
+    ttest.name = "test_timing_merge_structural";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.numops = 1000000;
+    ttest.test = test_timing_replicated_slot_reads;
+    ttest.name = "test_timing_replicated_slot_reads";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_numa_slot_reads;
+    ttest.name = "test_timing_numa_slot_reads";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_reads_verify_always;
+    ttest.name = "test_timing_reads_verify_always";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_reads_verify_replica;
+    ttest.name = "test_timing_reads_verify_replica";
+    unit_test(nullptr, ttest.name, true, &ttest);
+    ttest.test = test_timing_reads_verify_sampled;
+    ttest.name = "test_timing_reads_verify_sampled";
+    unit_test(nullptr, ttest.name, true, &ttest);
+
     printf("...Tests Complete\n");
 
     return 0;
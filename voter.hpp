@@ -33,7 +33,7 @@ struct Voter {
             o_loop_next: ;
             }
 
-            if (vals.size() == 1) // Terminate early on full agreement
+            if (insert_pos == 1) // Terminate early on full agreement
                 { goto done; }
 
             for (size_t count_it = 0; count_it != insert_pos; ++count_it) {